@@ -0,0 +1,393 @@
+/*
+ * bench.c
+ * Reproducible allocator benchmark, built and run by make bench.
+ * Every workload is generated in advance as a trace of malloc, free and
+ * realloc operations from fixed seed, then the same trace is replayed
+ * on fresh YAMAL heap, once for every placement policy engine has,
+ * and on malloc of C library. For each operation
+ * latency percentiles are measured, for YAMAL also number of blocks on
+ * the heap (length of a walk through all of them) and fragmentation of
+ * free space, both taken right before blocks still in use are freed.
+ * Fragmentation is part of free space which lies outside of largest
+ * free block, as in replay.
+ *
+ * Usage: bench [seed [operations]]
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <allocator.h>
+#include <allocator_lib.h>
+
+#define HEAPSIZE (64 * 1024 * 1024)
+#define SLOTS 1024
+#define BATCH 256
+
+uint8_t *_a_heapstart;
+size_t _a_heapsize;
+
+typedef enum { OP_MALLOC, OP_FREE, OP_REALLOC, OP_COUNT } t_OpType;
+
+static const char *opnames[OP_COUNT] = { "malloc", "free", "realloc" };
+
+typedef struct _op
+{
+    uint8_t type;
+    uint16_t slot;
+    uint32_t size;
+} t_Op;
+
+typedef struct _trace
+{
+    const char *name;
+    t_Op *ops;
+    size_t count, max;
+    size_t steady;
+} t_Trace;
+
+typedef struct _api
+{
+    const char *name;
+    void *(*alloc)(void *ctx, size_t size);
+    void (*release)(void *ctx, void *ptr);
+    void *(*resize)(void *ctx, void *ptr, size_t size);
+} t_Api;
+
+static uint64_t rngstate;
+
+/**
+ * \brief xorshift64*, same sequence on every platform.
+ */
+static uint64_t _rand(void)
+{
+    rngstate ^= rngstate >> 12;
+    rngstate ^= rngstate << 25;
+    rngstate ^= rngstate >> 27;
+    return rngstate * 2685821657736338717ULL;
+}
+
+static uint32_t _randr(uint32_t min, uint32_t max)
+{
+    return min + (uint32_t)(_rand() % (max - min + 1));
+}
+
+/**
+ * \brief Size drawn from power law, every twice larger octave is half as likely.
+ */
+static uint32_t _powerSize(void)
+{
+    int octave = 0;
+
+    while (octave < 12 && (_rand() & 1))
+        octave++;
+    return _randr(16 << octave, 32 << octave);
+}
+
+static void _emit(t_Trace *t, t_OpType type, uint16_t slot, uint32_t size)
+{
+    if (t->count == t->max)
+    {
+        t->max = (t->max ? t->max * 2 : 4096);
+        t->ops = realloc(t->ops, t->max * sizeof(t_Op));
+    }
+    t->ops[t->count].type = type;
+    t->ops[t->count].slot = slot;
+    t->ops[t->count].size = size;
+    t->count++;
+}
+
+/**
+ * \brief Random malloc and free of SLOTS slots, sizes given by sizefn.
+ */
+static void _genRandom(t_Trace *t, size_t n, uint32_t (*sizefn)(void))
+{
+    uint8_t live[SLOTS] = { 0 };
+    uint16_t slot;
+
+    while (t->count < n)
+    {
+        slot = _rand() % SLOTS;
+        if (live[slot])
+            _emit(t, OP_FREE, slot, 0);
+        else
+            _emit(t, OP_MALLOC, slot, sizefn());
+        live[slot] ^= 1;
+    }
+    t->steady = t->count;
+    for (slot = 0; slot < SLOTS; slot++)
+        if (live[slot])
+            _emit(t, OP_FREE, slot, 0);
+}
+
+static uint32_t _smallSize(void)
+{
+    return _randr(16, 128);
+}
+
+/**
+ * \brief Buffers grow by half with realloc until they reach 64KB,
+ * then are freed and started again.
+ */
+static void _genRealloc(t_Trace *t, size_t n)
+{
+    uint32_t size[SLOTS] = { 0 };
+    uint16_t slot;
+
+    while (t->count < n)
+    {
+        slot = _rand() % SLOTS;
+        if (!size[slot])
+        {
+            size[slot] = _randr(16, 256);
+            _emit(t, OP_MALLOC, slot, size[slot]);
+        }
+        else if (size[slot] > 64 * 1024)
+        {
+            _emit(t, OP_FREE, slot, 0);
+            size[slot] = 0;
+        }
+        else
+        {
+            size[slot] += size[slot] / 2;
+            _emit(t, OP_REALLOC, slot, size[slot]);
+        }
+    }
+    t->steady = t->count;
+    for (slot = 0; slot < SLOTS; slot++)
+        if (size[slot])
+            _emit(t, OP_FREE, slot, 0);
+}
+
+/**
+ * \brief Batches of BATCH blocks freed in reverse (lifo) or the same (fifo) order.
+ */
+static void _genOrder(t_Trace *t, size_t n, int lifo)
+{
+    while (t->count < n)
+    {
+        for (uint16_t i = 0; i < BATCH; i++)
+            _emit(t, OP_MALLOC, i, _randr(16, 512));
+        t->steady = t->count;
+        for (uint16_t i = 0; i < BATCH; i++)
+            _emit(t, OP_FREE, (lifo ? BATCH - 1 - i : i), 0);
+    }
+}
+
+/**
+ * \brief Tenth of slots holds long lived blocks freed only at the end,
+ * rest is freed soon after allocation.
+ */
+static void _genMixed(t_Trace *t, size_t n)
+{
+    uint8_t live[SLOTS] = { 0 };
+    uint16_t slot, longlived = SLOTS / 10;
+
+    while (t->count < n)
+    {
+        if (_rand() % 10 == 0)
+        {
+            slot = _rand() % longlived;
+            if (live[slot])
+                continue;
+            _emit(t, OP_MALLOC, slot, _powerSize());
+        }
+        else
+        {
+            slot = longlived + _rand() % 16;
+            if (live[slot])
+                _emit(t, OP_FREE, slot, 0);
+            else
+                _emit(t, OP_MALLOC, slot, _randr(16, 256));
+        }
+        live[slot] ^= 1;
+    }
+    t->steady = t->count;
+    for (slot = 0; slot < SLOTS; slot++)
+        if (live[slot])
+            _emit(t, OP_FREE, slot, 0);
+}
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *_yAlloc(void *ctx, size_t size) { return _ahmalloc(ctx, size); }
+static void _yFree(void *ctx, void *ptr) { _ahfree(ctx, ptr); }
+static void *_yRealloc(void *ctx, void *ptr, size_t size) { return _ahrealloc(ctx, ptr, size); }
+static void *_cAlloc(void *ctx, size_t size) { (void)ctx; return malloc(size); }
+static void _cFree(void *ctx, void *ptr) { (void)ctx; free(ptr); }
+static void *_cRealloc(void *ctx, void *ptr, size_t size) { (void)ctx; return realloc(ptr, size); }
+
+static const t_Api apis[] = {
+    { "yamal", _yAlloc, _yFree, _yRealloc },
+    { "libc", _cAlloc, _cFree, _cRealloc },
+};
+
+/*
+ * Placement policies YAMAL is run with, engine which doesn't have
+ * policy is skipped. Default one is printed as yamal.
+ */
+static const struct
+{
+    t_HeapPolicy policy;
+    const char *name;
+} policies[] = {
+    { HEAP_FIT_BEST, "yamal" },
+    { HEAP_FIT_FIRST, "first" },
+    { HEAP_FIT_NEXT, "next" },
+    { HEAP_FIT_ADDRESS, "addr" },
+};
+
+static int _cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * \brief Counts blocks of the heap, its free space and largest free block.
+ */
+static void _walk(t_Heap *heap, size_t *blocks, size_t *freesize, size_t *largest)
+{
+    *blocks = *freesize = *largest = 0;
+    for (t_MemNode *node = heap->firstblock; node; node = GET_NEXT(node))
+    {
+        (*blocks)++;
+        if (BLOCK_ISFREE(node))
+        {
+            *freesize += GET_BLOCKSIZE(node);
+            if (GET_BLOCKSIZE(node) > *largest)
+                *largest = GET_BLOCKSIZE(node);
+        }
+    }
+}
+
+/**
+ * \brief Replays trace on given allocator and prints one line of results.
+ */
+static void _replay(const t_Trace *t, const t_Api *api, const char *name, void *ctx, uint32_t **lat)
+{
+    void *slots[SLOTS] = { NULL };
+    size_t counts[OP_COUNT] = { 0 }, failed = 0, blocks = 0, freesize = 0, largest = 0;
+    uint64_t start, end, total = 0;
+    const t_Op *op;
+    void *ptr;
+
+    for (size_t i = 0; i < t->count; i++)
+    {
+        op = &t->ops[i];
+        start = _now();
+        switch (op->type)
+        {
+        case OP_MALLOC:
+            ptr = slots[op->slot] = api->alloc(ctx, op->size);
+            break;
+        case OP_FREE:
+            api->release(ctx, slots[op->slot]);
+            ptr = slots[op->slot] = NULL;
+            break;
+        default:
+            ptr = api->resize(ctx, slots[op->slot], op->size);
+            if (ptr)
+                slots[op->slot] = ptr;
+            break;
+        }
+        end = _now();
+        total += end - start;
+        lat[op->type][counts[op->type]++] = (uint32_t)(end - start);
+
+        if (ptr)
+            *(volatile uint8_t*)ptr = (uint8_t)i;
+        else if (op->type != OP_FREE)
+            failed++;
+
+        //state of the heap right before blocks still in use are freed
+        if (ctx && i + 1 == t->steady)
+            _walk(ctx, &blocks, &freesize, &largest);
+    }
+
+    printf("%-10s %-6s %10.0f", t->name, name, t->count / (total / 1e9));
+    for (int type = 0; type < OP_COUNT; type++)
+    {
+        if (!counts[type])
+        {
+            printf("  %22s", "-");
+            continue;
+        }
+        qsort(lat[type], counts[type], sizeof(uint32_t), _cmp);
+        printf("  %6u %6u %8u", lat[type][counts[type] / 2],
+               lat[type][counts[type] * 99 / 100], lat[type][counts[type] - 1]);
+    }
+    if (ctx)
+        printf("  %7zu %5.1f%%", blocks, (freesize ? 100.0 * (freesize - largest) / freesize : 0.0));
+    else
+        printf("  %7s %6s", "-", "-");
+    printf("  %zu\n", failed);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t seed = (argc > 1 ? strtoull(argv[1], NULL, 0) : 1);
+    size_t n = (argc > 2 ? strtoul(argv[2], NULL, 0) : 200000);
+    uint8_t *buf = malloc(HEAPSIZE);
+    t_Trace traces[] = {
+        { "small" }, { "powerlaw" }, { "realloc" }, { "lifo" }, { "fifo" }, { "mixed" },
+    };
+    uint32_t *lat[OP_COUNT];
+
+    if (!buf)
+        return 1;
+
+    rngstate = seed ? seed : 1;
+    _genRandom(&traces[0], n, _smallSize);
+    _genRandom(&traces[1], n, _powerSize);
+    _genRealloc(&traces[2], n);
+    _genOrder(&traces[3], n, 1);
+    _genOrder(&traces[4], n, 0);
+    _genMixed(&traces[5], n);
+
+    printf("seed %llu, %zu operations per workload, latencies in ns (p50 p99 max)\n",
+           (unsigned long long)seed, n);
+    printf("%-10s %-6s %10s  %22s  %22s  %22s  %7s %6s  %s\n", "workload", "alloc", "ops/s",
+           opnames[OP_MALLOC], opnames[OP_FREE], opnames[OP_REALLOC], "blocks", "frag", "failed");
+
+    for (size_t w = 0; w < sizeof(traces) / sizeof(traces[0]); w++)
+    {
+        for (int type = 0; type < OP_COUNT; type++)
+            lat[type] = malloc(traces[w].count * sizeof(uint32_t));
+
+        for (size_t a = 0; a < sizeof(apis) / sizeof(apis[0]); a++)
+        {
+            if (apis[a].alloc != _yAlloc)
+            {
+                _replay(&traces[w], &apis[a], apis[a].name, NULL, lat);
+                continue;
+            }
+            for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++)
+            {
+                t_Heap *heap = _aheapinit(buf, HEAPSIZE);
+
+                if (_ahsetpolicy(heap, policies[p].policy))
+                    _replay(&traces[w], &apis[a], policies[p].name, heap, lat);
+            }
+        }
+
+        for (int type = 0; type < OP_COUNT; type++)
+            free(lat[type]);
+        free(traces[w].ops);
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,309 @@
+/*
+ * replay.c
+ * Replays allocation trace recorded with ALLOCATOR_TRACE on fresh heap
+ * of given size, using engine and options this tool was built with
+ * (e.g. make replay ENGINE=tlsf), tracing itself is left out.
+ * Blocks are matched by addresses they had in traced program, so trace
+ * of many heaps is replayed on one. Prints time spent in allocator,
+ * failed allocations, peak of requested bytes and blocks, free space and
+ * largest free block near the peak and at the end.
+ * Records of different threads may come slightly out of order when
+ * block moved by realloc was taken by other thread at once, operations
+ * on addresses not known at that moment are counted as unmatched.
+ *
+ * Fragmentation is part of free space which lies outside of largest
+ * free block. Placement policy of the heap can be given by name.
+ *
+ * Usage: replay trace [heapsize [best|first|next|address]]
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <allocator.h>
+#include <allocator_lib.h>
+
+uint8_t *_a_heapstart;
+size_t _a_heapsize;
+
+/*! \struct t_Live
+ * \brief Block in use, address from trace mapped to address in replay.
+ */
+typedef struct _live
+{
+    uint64_t id;
+    void *ptr;
+    size_t size;
+} t_Live;
+
+/*! \struct t_Map
+ * \brief Open addressing hash table of blocks in use, deleted entries
+ * are marked with NULL ptr.
+ */
+typedef struct _map
+{
+    t_Live *slots;
+    size_t mask, used, count;
+} t_Map;
+
+typedef struct _usage
+{
+    size_t blocks, free, largest;
+} t_Usage;
+
+static size_t _hash(t_Map *map, uint64_t id)
+{
+    return (size_t)((id >> 3) * 0x9E3779B97F4A7C15ULL) & map->mask;
+}
+
+static t_Live *_find(t_Map *map, uint64_t id)
+{
+    for (size_t i = _hash(map, id);; i = (i + 1) & map->mask)
+    {
+        if (!map->slots[i].id)
+            return NULL;
+        if (map->slots[i].id == id && map->slots[i].ptr)
+            return &map->slots[i];
+    }
+}
+
+static void _insert(t_Map *map, uint64_t id, void *ptr, size_t size);
+
+/**
+ * \brief Doubles the table, dropping deleted entries.
+ */
+static void _grow(t_Map *map)
+{
+    t_Map old = *map;
+
+    map->mask = (old.slots ? old.mask * 2 + 1 : 4095);
+    map->slots = calloc(map->mask + 1, sizeof(t_Live));
+    map->used = map->count = 0;
+    if (!map->slots)
+    {
+        perror("replay");
+        exit(1);
+    }
+    for (size_t i = 0; old.slots && i <= old.mask; i++)
+        if (old.slots[i].ptr)
+            _insert(map, old.slots[i].id, old.slots[i].ptr, old.slots[i].size);
+    free(old.slots);
+}
+
+static void _insert(t_Map *map, uint64_t id, void *ptr, size_t size)
+{
+    size_t i;
+
+    if ((map->used + 1) * 4 > (map->mask + 1) * 3 || !map->slots)
+        _grow(map);
+
+    for (i = _hash(map, id); map->slots[i].id; i = (i + 1) & map->mask)
+        ;
+    map->slots[i].id = id;
+    map->slots[i].ptr = ptr;
+    map->slots[i].size = size;
+    map->used++;
+    map->count++;
+}
+
+static void _remove(t_Map *map, t_Live *live)
+{
+    live->ptr = NULL;
+    map->count--;
+}
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * \brief Walks all blocks of the heap.
+ */
+static void _walk(t_Heap *heap, t_Usage *usage)
+{
+    usage->blocks = usage->free = usage->largest = 0;
+    for (t_MemNode *node = heap->firstblock; node; node = GET_NEXT(node))
+    {
+        usage->blocks++;
+        if (BLOCK_ISFREE(node))
+        {
+            usage->free += GET_BLOCKSIZE(node);
+            if (GET_BLOCKSIZE(node) > usage->largest)
+                usage->largest = GET_BLOCKSIZE(node);
+        }
+    }
+}
+
+static void _print(const char *name, t_Usage *usage)
+{
+    printf("%-9s blocks %zu, free %zu bytes, largest free %zu bytes, fragmentation %.1f%%\n",
+           name, usage->blocks, usage->free, usage->largest,
+           (usage->free ? 100.0 * (usage->free - usage->largest) / usage->free : 0.0));
+}
+
+//names of t_HeapPolicy values, in their order
+static const char *policies[] = { "best", "first", "next", "address" };
+
+int main(int argc, char **argv)
+{
+    size_t heapsize = (argc > 2 ? strtoul(argv[2], NULL, 0) : 64 * 1024 * 1024);
+    size_t ops[TRACE_MEMALIGN + 1] = { 0 }, failed = 0, unmatched = 0;
+    size_t inuse = 0, peak = 0, peakblocks = 0, walked = 0, policy = 0;
+    uint64_t start, total = 0;
+    t_Map map = { 0 };
+    t_TraceRecord rec;
+    t_Usage atpeak = { 0 }, atend;
+    t_Live *live;
+    t_Heap *heap;
+    uint8_t *buf;
+    void *ptr;
+    FILE *f;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s trace [heapsize [best|first|next|address]]\n", argv[0]);
+        return 1;
+    }
+    while (argc > 3 && policy < sizeof(policies) / sizeof(policies[0]) && strcmp(argv[3], policies[policy]))
+        policy++;
+
+    f = fopen(argv[1], "rb");
+    buf = malloc(heapsize);
+    if (!f || !buf)
+    {
+        perror("replay");
+        return 1;
+    }
+    heap = _aheapinit(buf, heapsize);
+    if (!heap)
+    {
+        fprintf(stderr, "replay: heap of %zu bytes is too small\n", heapsize);
+        return 1;
+    }
+    if (policy == sizeof(policies) / sizeof(policies[0]) || !_ahsetpolicy(heap, (t_HeapPolicy)policy))
+    {
+        fprintf(stderr, "replay: engine doesn't have policy %s\n", argv[3]);
+        return 1;
+    }
+
+    while (fread(&rec, sizeof(rec), 1, f) == 1)
+    {
+        if (rec.op < TRACE_MALLOC || rec.op > TRACE_MEMALIGN)
+        {
+            fprintf(stderr, "replay: bad record %u\n", rec.seq);
+            return 1;
+        }
+        ops[rec.op]++;
+
+        //realloc of NULL allocates, to zero size frees
+        if (rec.op == TRACE_REALLOC && !rec.arg)
+            rec.op = TRACE_MALLOC;
+        else if (rec.op == TRACE_REALLOC && !rec.size)
+        {
+            rec.op = TRACE_FREE;
+            rec.ptr = rec.arg;
+        }
+
+        live = NULL;
+        if (rec.op == TRACE_FREE || rec.op == TRACE_REALLOC)
+        {
+            live = _find(&map, (rec.op == TRACE_FREE ? rec.ptr : rec.arg));
+            if (!live)
+            {
+                if (rec.ptr || rec.op == TRACE_REALLOC)
+                    unmatched++;
+                continue;
+            }
+        }
+
+        start = _now();
+        switch (rec.op)
+        {
+        case TRACE_MALLOC:
+            ptr = _ahmalloc(heap, rec.size);
+            break;
+        case TRACE_MEMALIGN:
+            ptr = _ahmemalign(heap, rec.arg, rec.size);
+            break;
+        case TRACE_FREE:
+            _ahfree(heap, live->ptr);
+            ptr = NULL;
+            break;
+        default:
+            ptr = _ahrealloc(heap, live->ptr, rec.size);
+            break;
+        }
+        total += _now() - start;
+
+        if (live && (ptr || rec.op == TRACE_FREE))
+        {
+            inuse -= live->size;
+            _remove(&map, live);
+        }
+
+        if (rec.op == TRACE_FREE)
+            continue;
+
+        //failed in traced program, replayed block keeps address of the old one
+        if (!rec.ptr)
+        {
+            if (ptr && rec.op == TRACE_REALLOC)
+                rec.ptr = rec.arg;
+            else
+            {
+                if (ptr)
+                    _ahfree(heap, ptr);
+                continue;
+            }
+        }
+        if (!ptr)
+        {
+            failed++;
+            continue;
+        }
+        //zero size allocation gives first block of the heap, which isn't freed
+        if (!rec.size)
+            continue;
+
+        _insert(&map, rec.ptr, ptr, rec.size);
+        inuse += rec.size;
+        if (inuse > peak)
+        {
+            peak = inuse;
+            peakblocks = map.count;
+            //walking the heap is costly, it's repeated when peak grows by 1/64
+            if (peak - walked >= walked / 64 || !walked)
+            {
+                walked = peak;
+                _walk(heap, &atpeak);
+            }
+        }
+    }
+    fclose(f);
+
+    _walk(heap, &atend);
+
+    printf("records   malloc %zu, free %zu, realloc %zu, memalign %zu\n",
+           ops[TRACE_MALLOC], ops[TRACE_FREE], ops[TRACE_REALLOC], ops[TRACE_MEMALIGN]);
+    printf("heap      %zu bytes, %s fit, %.3f ms in allocator\n", heapsize, policies[policy], total / 1e6);
+    printf("failed    %zu, unmatched %zu\n", failed, unmatched);
+    printf("peak      %zu bytes in %zu blocks\n", peak, peakblocks);
+    _print("near peak", &atpeak);
+    printf("end       %zu bytes in %zu blocks still in use\n", inuse, map.count);
+    _print("at end", &atend);
+
+    free(map.slots);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <allocator.h>
+#include <allocator_lib.h>
+
+/*
+ * Frees blocks twice and overflows one block into the next one, every
+ * error has to be reported once and heap has to stay intact after
+ * double frees. Sizes are picked so blocks come from slab (SLAB=yes),
+ * thread cache (THREADS=yes) and engine. Build with make CANARY=yes.
+ */
+
+#define MEMSIZE (256 * 1024)
+
+uint8_t *_a_heapstart;
+size_t _a_heapsize;
+
+static size_t reported[HEAP_ERROR_LINK + 1];
+
+void _aheaperror(t_Heap *heap, void *ptr, t_HeapError error)
+{
+    printf("Heap %p: error %d, block %p\n", (void*)heap, error, ptr);
+    reported[error]++;
+}
+
+int main(void)
+{
+#ifdef ALLOCATOR_CANARY
+    static const size_t sizes[] = { 24, 200, 4000 };
+    size_t failed = 0;
+    char *first, *mem, *next;
+
+    _a_heapstart = malloc(MEMSIZE);
+    _a_heapsize = MEMSIZE;
+
+    //first block is given for zero size too, so it's never reported as freed
+    first = _amalloc(4000);
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        printf("Case %zu - free block of %zu bytes twice\n", i, sizes[i]);
+        mem = _amalloc(sizes[i]);
+        _afree((uintptr_t*)mem);
+        _afree((uintptr_t*)mem);
+        if (reported[HEAP_ERROR_FREED] != i + 1)
+        {
+            printf("Double free wasn't reported\n");
+            failed++;
+        }
+        reported[HEAP_ERROR_FREED] = i + 1;
+
+        mem = _amalloc(sizes[i]);
+        next = _amalloc(sizes[i]);
+        if (mem == next)
+        {
+            printf("Block was given out twice\n");
+            failed++;
+        }
+        _afree((uintptr_t*)mem);
+        _afree((uintptr_t*)next);
+    }
+
+    if (_avalidate(NULL) != 0)
+    {
+        printf("Heap is broken\n");
+        failed++;
+    }
+
+    //block with broken node is left alone, heap isn't validated after it
+    printf("Case 3 - overflow block into node of the next one\n");
+    mem = _amalloc(4000);
+    next = _amalloc(4000);
+    if (GET_NEXT((t_MemNode*)OFFSET(mem, -SSIZE)) == (t_MemNode*)OFFSET(next, -SSIZE))
+    {
+        memset(mem, 'A', _amalloc_usable_size(mem) + sizeof(uintptr_t));
+        _afree((uintptr_t*)next);
+        if (reported[HEAP_ERROR_CANARY] != 1)
+        {
+            printf("Overflow wasn't reported\n");
+            failed++;
+        }
+    }
+    _afree((uintptr_t*)mem);
+    _afree((uintptr_t*)first);
+
+    printf("%s\n", (failed ? "FAILED" : "OK"));
+    free(_a_heapstart);
+    return (failed != 0);
+#else
+    printf("Build with make CANARY=yes\n");
+    return 0;
+#endif
+}
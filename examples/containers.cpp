@@ -0,0 +1,50 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+#include <allocator.hpp>
+
+#define MEMSIZE (64*1024)
+#define HOTSIZE (16*1024)
+
+uint8_t *_a_heapstart;
+size_t _a_heapsize;
+
+static uint8_t hotbuf[HOTSIZE];
+
+int main(void)
+{
+    _a_heapstart = (uint8_t*)malloc(MEMSIZE);
+    _a_heapsize = MEMSIZE;
+
+    printf("---------------------------------------------------\n");
+    printf("Case 1 - std::vector on default heap\n");
+    std::vector<int, yamal::allocator<int> > vec;
+    for (int i = 0; i < 100; i++)
+        vec.push_back(i);
+    printf("%zu elements, sum of first and last %d\n", vec.size(), vec.front() + vec.back());
+    printf("---------------------------------------------------\n");
+
+    printf("Case 2 - std::map on separate heap\n");
+    t_Heap *hot = _aheapinit(hotbuf, HOTSIZE);
+    typedef std::pair<const int, int> t_Pair;
+    std::map<int, int, std::less<int>, yamal::allocator<t_Pair> > map((yamal::allocator<t_Pair>(hot)));
+    for (int i = 0; i < 50; i++)
+        map[i] = i * i;
+    printf("%zu nodes, map[7] = %d\n", map.size(), map[7]);
+    _printHeapAllocs(hot, NULL);
+    printf("---------------------------------------------------\n");
+
+#ifdef ALLOCATOR_PMR
+    printf("Case 3 - std::pmr::vector of cache line aligned counters on separate heap\n");
+    struct alignas(64) t_Counter { long value; };
+    static uint8_t pmrbuf[HOTSIZE];
+    yamal::heap_resource res(pmrbuf, HOTSIZE);
+    std::pmr::vector<t_Counter> counters(8, t_Counter{0}, &res);
+    printf("%zu counters, aligned to 64: %s\n", counters.size(),
+           ((uintptr_t)counters.data() % 64) ? "no" : "yes");
+    printf("---------------------------------------------------\n");
+#endif
+
+    return 0;
+}
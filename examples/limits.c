@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <allocator.h>
+
+/*
+ * Calls which have to fail or be ignored without harm to the heap:
+ * realloc over size of the heap and block freed twice in one batch.
+ * Blocks are checked to keep their contents and heap is validated
+ * after every case. Works in any build, e.g. make ENGINE=tlsf MMAP=yes.
+ */
+
+#define MEMSIZE (256 * 1024)
+
+uint8_t *_a_heapstart;
+size_t _a_heapsize;
+
+/**
+ * \brief Checks that all size bytes of mem are still pattern.
+ */
+static int _intact(const char *mem, size_t size, char pattern)
+{
+    for (size_t i = 0; i < size; i++)
+        if (mem[i] != pattern)
+            return 0;
+    return 1;
+}
+
+int main(void)
+{
+    static const size_t sizes[] = { 24, 200, 4000 };
+    static const size_t huge[] = { SIZE_MAX, SIZE_MAX - 1, SIZE_MAX - 2 * sizeof(uintptr_t), SIZE_MAX / 2 };
+    size_t failed = 0, usable;
+    char *mem, *newmem;
+
+    _a_heapstart = malloc(MEMSIZE);
+    _a_heapsize = MEMSIZE;
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        printf("Case %zu - realloc block of %zu bytes over size of the heap\n", i, sizes[i]);
+        mem = _amalloc(sizes[i]);
+        memset(mem, 'A' + (char)i, sizes[i]);
+        usable = _amalloc_usable_size(mem);
+        for (size_t j = 0; j < sizeof(huge) / sizeof(huge[0]); j++)
+        {
+            newmem = _arealloc((uintptr_t*)mem, huge[j]);
+            if (newmem)
+            {
+                printf("Realloc to %zu bytes returned %p\n", huge[j], (void*)newmem);
+                failed++;
+                mem = newmem;
+            }
+            else if (!_intact(mem, sizes[i], 'A' + (char)i) || _amalloc_usable_size(mem) != usable)
+            {
+                printf("Block changed by failed realloc to %zu bytes\n", huge[j]);
+                failed++;
+            }
+        }
+        _afree((uintptr_t*)mem);
+        if (_avalidate(NULL) != 0)
+        {
+            printf("Heap is broken\n");
+            failed++;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        void *batch[3], *taken[8], *fence;
+        size_t shared = 0;
+
+        printf("Case %zu - free block of %zu bytes twice in one batch\n", i + 3, sizes[i]);
+        batch[0] = batch[2] = _amalloc(sizes[i]);
+        batch[1] = _amalloc(sizes[i]);
+        //freed blocks aren't joined with free space after them
+        fence = _amalloc(sizes[i]);
+        _afree_batch(batch, 3);
+
+        //block freed twice would be given out twice and overwritten
+        for (size_t j = 0; j < 8; j++)
+        {
+            taken[j] = _amalloc(sizes[i]);
+            memset(taken[j], 'a' + (char)j, sizes[i]);
+        }
+        for (size_t j = 0; j < 8; j++)
+            if (!_intact(taken[j], sizes[i], 'a' + (char)j))
+                shared++;
+        if (shared)
+        {
+            printf("Block was given out twice\n");
+            failed++;
+        }
+        _afree_batch(taken, 8);
+        _afree((uintptr_t*)fence);
+        if (_avalidate(NULL) != 0)
+        {
+            printf("Heap is broken\n");
+            failed++;
+        }
+    }
+
+    printf("%s\n", (failed ? "FAILED" : "OK"));
+    free(_a_heapstart);
+    return (failed != 0);
+}
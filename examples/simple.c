@@ -55,6 +55,16 @@ int main(void)
     _printAllocs(NULL);
     printf("---------------------------------------------------\n");
 
+    printf("Case 6 - alloc block 'H' from separate heap\n");
+    uint8_t *buf = malloc(MEMSIZE / 4);
+    t_Heap *heap = _aheapinit(buf, MEMSIZE / 4);
+    mem[3] = _ahmalloc(heap, 100);
+    mem[3][0] = 'H';
+    _printHeapAllocs(heap, NULL);
+    _ahfree(heap, (uintptr_t*)mem[3]);
+    free(buf);
+    printf("---------------------------------------------------\n");
+
     free(_a_heapstart);
     return 0;
 }
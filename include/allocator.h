@@ -4,11 +4,91 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#ifdef _cplusplus
+#ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef struct _mem_node t_MemNode;
+typedef struct _heap t_Heap;
+typedef struct _region t_Region;
+typedef struct _handle *t_Handle;
+
+/*! \struct t_HeapStats
+ * \brief Heap counters returned by _agetstats(). Sizes of blocks in use
+ * are sizes of their payload, sizes of free blocks include nodes.
+ * Blocks kept in slab pages and thread caches, which aren't used by
+ * the program, are neither used nor free.
+ */
+typedef struct _heap_stats
+{
+    size_t size;        //!< bytes managed by engine
+    size_t used;        //!< bytes of blocks in use
+    size_t usedblocks;  //!< number of blocks in use
+    size_t free;        //!< bytes of free blocks
+    size_t largest;     //!< largest payload which can be allocated at once
+    size_t peak;        //!< highest number of bytes in use so far
+    size_t mallocs;     //!< calls of malloc, calloc and memalign
+    size_t frees;       //!< calls of free
+    size_t reallocs;    //!< calls of realloc
+    size_t failed;      //!< allocations and reallocations which returned NULL
+} t_HeapStats;
+
+/*! \enum t_TraceOp
+ * \brief Operations recorded in trace.
+ */
+typedef enum
+{
+    TRACE_MALLOC = 1,
+    TRACE_FREE,
+    TRACE_REALLOC,
+    TRACE_MEMALIGN
+} t_TraceOp;
+
+/*! \struct t_TraceRecord
+ * \brief One record of allocation trace. Blocks are identified by
+ * address they got in traced program, 0 when allocation failed.
+ * For _arealloc() arg is the previous address, for _amemalign()
+ * the alignment.
+ */
+typedef struct _trace_record
+{
+    uint32_t seq;
+    uint8_t op;
+    uint8_t reserved[3];
+    uint64_t time;
+    uint64_t size;
+    uint64_t ptr;
+    uint64_t arg;
+} t_TraceRecord;
+
+/*! \enum t_HeapError
+ * \brief Errors found by _avalidate() and, with ALLOCATOR_CANARY, by _afree()
+ * and _arealloc().
+ */
+typedef enum
+{
+    HEAP_ERROR_CANARY = 1,  //!< header of used block was overwritten
+    HEAP_ERROR_FREED,       //!< block which isn't used was freed or reallocated
+    HEAP_ERROR_NODE,        //!< node lies or reaches outside of the heap, rest of heap isn't checked
+    HEAP_ERROR_LINK         //!< link to previous block doesn't point to it
+} t_HeapError;
+
+/*! \enum t_HeapPolicy
+ * \brief Placement policy, how list engine chooses free block for allocation.
+ */
+typedef enum
+{
+    HEAP_FIT_BEST = 0,  //!< smallest block which fits, whole heap is searched (default)
+    HEAP_FIT_FIRST,     //!< first block which fits
+    HEAP_FIT_NEXT,      //!< first block which fits, search resumes where last one stopped
+    HEAP_FIT_ADDRESS    //!< smallest of first ALLOCATOR_FIT_SEARCH blocks which fit, in address order
+} t_HeapPolicy;
+
+/*! \typedef t_HeapReport
+ * \brief Callback reporting error of the heap, ptr is address of the block
+ * as given to the program.
+ */
+typedef void (*t_HeapReport)(t_Heap *heap, void *ptr, t_HeapError error);
 
 //Below are two variables declared, which should be defined as globals in code using this lib,
 //they cannot be declared as static and should be initialized prior to
@@ -24,18 +104,343 @@ extern uint8_t *_a_heapstart;
  */
 extern size_t _a_heapsize;
 
+/*! \def ALLOCATOR_COMPACT
+ * \brief Define (or add -DALLOCATOR_COMPACT, or build with make COMPACT=yes)
+ * to keep links of node as 32 bit distances and size as 32 bit number,
+ * so node takes 8 bytes (12 with boundary tags or TLSF) instead of two
+ * (three) pointers, with naturally aligned fields. Every heap and pool
+ * is limited to 2GB. ALLOCATOR_ALIGNMENT defaults to 8 then, set it to 16
+ * if 16 byte aligned blocks are needed, node takes 16 bytes again.
+ */
+//#define ALLOCATOR_COMPACT
+
+/*! \def ALLOCATOR_PERSIST
+ * \brief Define (or add -DALLOCATOR_PERSIST, or build with make PERSIST=yes)
+ * to keep heap in file or shared memory with _apersistopen(). Such heap
+ * holds no absolute address, so it can be mapped at different address
+ * by every process using it and opened again after all of them exit.
+ * Implies ALLOCATOR_COMPACT and ALLOCATOR_THREADSAFE, works only with
+ * list engine, without ALLOCATOR_FREE_LIST, ALLOCATOR_SLAB, ALLOCATOR_POOLS,
+ * ALLOCATOR_MMAP and ALLOCATOR_REMOTE_FREE. Requires persist.c and POSIX system.
+ */
+//#define ALLOCATOR_PERSIST
+
+#ifdef ALLOCATOR_PERSIST
+#ifndef ALLOCATOR_COMPACT
+#define ALLOCATOR_COMPACT
+#endif
+#ifndef ALLOCATOR_THREADSAFE
+#define ALLOCATOR_THREADSAFE
+#endif
+#endif
+
 /*! \def ALLOCATOR_ALIGNMENT
- * \brief Alignment of memory addres
+ * \brief Alignment of memory addres returned by _amalloc(), power of two.
+ * Defaults to two pointers (16 bytes on 64 bit, 8 bytes on 32 bit targets),
+ * the same as malloc() of glibc, and to 8 bytes for compact nodes.
+ * Add -DALLOCATOR_ALIGNMENT=4 to trade alignment for less memory used by
+ * nodes on small targets.
  */
-#define ALLOCATOR_ALIGNMENT 4
+#ifndef ALLOCATOR_ALIGNMENT
+#if defined(ALLOCATOR_COMPACT)
+#define ALLOCATOR_ALIGNMENT 8
+#elif UINTPTR_MAX > 0xFFFFFFFFu
+#define ALLOCATOR_ALIGNMENT 16
+#else
+#define ALLOCATOR_ALIGNMENT 8
+#endif
+#endif
 
 
+/*! \def ALLOCATOR_CANARY
+ * \brief Define (or add -DALLOCATOR_CANARY, or build with make CANARY=yes)
+ * to keep canary made of block size in every node. Canary of used block
+ * is checked in constant time by _afree() and _arealloc(), broken block
+ * and block freed twice are reported to _aheaperror() and left alone.
+ * guard() checks of every operation are left out, whole heap is checked
+ * by _avalidate(). Node is larger by a pointer (4 bytes in compact node).
+ */
+//#define ALLOCATOR_CANARY
+
+#ifdef ALLOCATOR_CANARY
+/*! \def ALLOCATOR_CANARY_KEY
+ * \brief Value canary is made of, can be set per build.
+ */
+#ifndef ALLOCATOR_CANARY_KEY
+#define ALLOCATOR_CANARY_KEY 0x5A3C96E1u
+#endif
+#endif
+
 /*! \def ALLOCATOR_USEREPORT
  * \brief Comment this def out if don't want _printAllocs() function
  * in your code. Or add -DALLOCATOR_USEREPORT
  */
 #define ALLOCATOR_USEREPORT
 
+/*! \def ALLOCATOR_ENGINE_TLSF
+ * \brief Define (or add -DALLOCATOR_ENGINE_TLSF, or build with make ENGINE=tlsf)
+ * to use two-level segregated fit engine instead of default list engine.
+ * Allocation and free are then done in constant time, regardless of number
+ * of blocks on the heap, at cost of larger node and static lookup table.
+ */
+//#define ALLOCATOR_ENGINE_TLSF
+
+/*! \def ALLOCATOR_ENGINE_BUDDY
+ * \brief Define (or add -DALLOCATOR_ENGINE_BUDDY, or build with make ENGINE=buddy)
+ * to use binary buddy engine. Every block is rounded up to power of two,
+ * freed block is merged with its buddy found by XOR of its offset.
+ * Bitmaps of free blocks are kept at the start of the heap.
+ */
+//#define ALLOCATOR_ENGINE_BUDDY
+
+/*! \def ALLOCATOR_BUDDY_ALIGN
+ * \brief Largest alignment of payload buddy engine gives, power of two.
+ * Blocks start where payload of the first one is aligned to it, space in
+ * front of them is lost. Heap smaller than 64 times of it gets smaller
+ * alignment, but at least 64 bytes.
+ */
+#ifndef ALLOCATOR_BUDDY_ALIGN
+#define ALLOCATOR_BUDDY_ALIGN 4096
+#endif
+
+/*! \def ALLOCATOR_BOUNDARY_TAGS
+ * \brief Define (or add -DALLOCATOR_BOUNDARY_TAGS, or build with make TAGS=yes)
+ * to keep address of previous block in every node of list engine.
+ * _afree() then merges block with both of its neighbours at once, instead
+ * of walking whole list. TLSF engine always keeps it.
+ */
+//#define ALLOCATOR_BOUNDARY_TAGS
+
+/*! \def ALLOCATOR_FREE_LIST
+ * \brief Define (or add -DALLOCATOR_FREE_LIST, or build with make FREELIST=yes)
+ * to keep free blocks of list engine in separate doubly linked list,
+ * which links are stored in unused space of free blocks. Search for free
+ * block then skips all used blocks. Implies ALLOCATOR_BOUNDARY_TAGS.
+ */
+//#define ALLOCATOR_FREE_LIST
+
+#if defined(ALLOCATOR_FREE_LIST) && !defined(ALLOCATOR_BOUNDARY_TAGS)
+#define ALLOCATOR_BOUNDARY_TAGS
+#endif
+
+/*! \def ALLOCATOR_FIT_SEARCH
+ * \brief Number of fitting blocks compared by HEAP_FIT_ADDRESS policy of
+ * list engine, smallest of them is taken.
+ */
+#ifndef ALLOCATOR_FIT_SEARCH
+#define ALLOCATOR_FIT_SEARCH 8
+#endif
+
+/*! \def ALLOCATOR_REMOTE_FREE
+ * \brief Define (or add -DALLOCATOR_REMOTE_FREE, or build with make REMOTE=yes)
+ * to let heap made by _aheapinit() have owner thread set by _ahsetowner().
+ * Blocks freed by other threads are pushed on lock-free stack of the heap
+ * and returned to the engine by owner on its next allocation, all at once.
+ * Implies ALLOCATOR_THREADSAFE. Requires remote.c.
+ */
+//#define ALLOCATOR_REMOTE_FREE
+
+#if defined(ALLOCATOR_REMOTE_FREE) && !defined(ALLOCATOR_THREADSAFE)
+#define ALLOCATOR_THREADSAFE
+#endif
+
+#ifdef ALLOCATOR_REMOTE_FREE
+/*! \def ALLOCATOR_CACHELINE
+ * \brief Size of cache line, stack of remote frees is kept apart from
+ * the rest of heap state on line of its own.
+ */
+#ifndef ALLOCATOR_CACHELINE
+#define ALLOCATOR_CACHELINE 64
+#endif
+#endif
+
+/*! \def ALLOCATOR_THREADSAFE
+ * \brief Define (or add -DALLOCATOR_THREADSAFE, or build with make THREADS=yes)
+ * to guard heap with a lock and keep per thread caches of small freed
+ * blocks in front of it. Requires tcache.c.
+ */
+//#define ALLOCATOR_THREADSAFE
+
+#ifdef ALLOCATOR_THREADSAFE
+/*! \def ALLOCATOR_TCACHE_STEP
+ * \brief Step between size classes of thread cache, in bytes of payload.
+ * Must not be smaller than size of a pointer.
+ */
+#ifndef ALLOCATOR_TCACHE_STEP
+#define ALLOCATOR_TCACHE_STEP 16
+#endif
+
+/*! \def ALLOCATOR_TCACHE_CLASSES
+ * \brief Number of size classes, blocks larger than
+ * ALLOCATOR_TCACHE_CLASSES * ALLOCATOR_TCACHE_STEP aren't cached. 0 disables caches.
+ */
+#ifndef ALLOCATOR_TCACHE_CLASSES
+#define ALLOCATOR_TCACHE_CLASSES 16
+#endif
+
+/*! \def ALLOCATOR_TCACHE_COUNT
+ * \brief Number of blocks kept in one size class before it's flushed to the heap.
+ */
+#ifndef ALLOCATOR_TCACHE_COUNT
+#define ALLOCATOR_TCACHE_COUNT 32
+#endif
+
+/*! \def ALLOCATOR_TCACHE_BATCH
+ * \brief Number of blocks taken from or returned to the heap at once.
+ */
+#ifndef ALLOCATOR_TCACHE_BATCH
+#define ALLOCATOR_TCACHE_BATCH 8
+#endif
+#endif
+
+#ifdef ALLOCATOR_ENGINE_TLSF
+/*! \def ALLOCATOR_TLSF_SLBITS
+ * \brief log2 of number of second level lists per first level (power of two) range.
+ * More lists mean less wasted space and bigger lookup table. Maximum is 5.
+ */
+#ifndef ALLOCATOR_TLSF_SLBITS
+#define ALLOCATOR_TLSF_SLBITS 4
+#endif
+
+/*! \def ALLOCATOR_TLSF_FLMAX
+ * \brief log2 of the largest block engine is able to handle. Heap above
+ * this size is trimmed to it.
+ */
+#ifndef ALLOCATOR_TLSF_FLMAX
+#define ALLOCATOR_TLSF_FLMAX 32
+#endif
+#endif
+
+/*! \def ALLOCATOR_SLAB
+ * \brief Define (or add -DALLOCATOR_SLAB, or build with make SLAB=yes)
+ * to serve small objects from slab pages carved out of the heap.
+ * Such objects have no node, are never searched for and need no
+ * consolidation. Requires slab.c.
+ */
+//#define ALLOCATOR_SLAB
+
+/*! \def ALLOCATOR_STATS
+ * \brief Define (or add -DALLOCATOR_STATS, or build with make STATS=yes)
+ * to keep counters of every heap up to date on each operation, so
+ * _agetstats() returns them at once, without walking the heap or taking
+ * its lock. Requires stats.c.
+ */
+//#define ALLOCATOR_STATS
+
+/*! \def ALLOCATOR_POOLS
+ * \brief Define (or add -DALLOCATOR_POOLS, or build with make POOLS=yes)
+ * to let heap grow by memory pools, which don't have to be adjacent to it.
+ * Pool is added by _aaddpool() or, when heap is full, taken from _agrow().
+ * Every pool is heap of its own, chained to the heap it was added to,
+ * allocation which doesn't fit in the heap is tried in its pools.
+ */
+//#define ALLOCATOR_POOLS
+
+#ifdef ALLOCATOR_POOLS
+/*! \def ALLOCATOR_GROW_SIZE
+ * \brief Smallest pool asked from _agrow().
+ */
+#ifndef ALLOCATOR_GROW_SIZE
+#define ALLOCATOR_GROW_SIZE (64 * 1024)
+#endif
+#endif
+
+/*! \def ALLOCATOR_MMAP
+ * \brief Define (or add -DALLOCATOR_MMAP, or build with make MMAP=yes)
+ * to give every block of at least ALLOCATOR_MMAP_THRESHOLD bytes anonymous
+ * mapping of its own, which is resized by mremap() and unmapped as soon
+ * as block is freed. Adds _atrim(), which gives pages of free blocks
+ * back to the system. Requires mmap.c and POSIX system.
+ */
+//#define ALLOCATOR_MMAP
+
+#ifdef ALLOCATOR_MMAP
+/*! \def ALLOCATOR_MMAP_THRESHOLD
+ * \brief Smallest block which gets mapping of its own.
+ */
+#ifndef ALLOCATOR_MMAP_THRESHOLD
+#define ALLOCATOR_MMAP_THRESHOLD (128 * 1024)
+#endif
+#endif
+
+/*! \def ALLOCATOR_REGION
+ * \brief Define (or add -DALLOCATOR_REGION, or build with make REGION=yes)
+ * to carve regions out of heap. Region gives memory by bumping pointer,
+ * objects have no node and are never freed one by one, whole region is
+ * rolled back to mark or reset at once. Requires region.c.
+ */
+//#define ALLOCATOR_REGION
+
+/*! \def ALLOCATOR_HANDLES
+ * \brief Define (or add -DALLOCATOR_HANDLES, or build with make HANDLES=yes)
+ * to allocate movable blocks reached by handle, which is locked to get
+ * address of the block. _acompact() slides unlocked blocks down the heap,
+ * joining free space left between them. Works only with list engine.
+ * Requires handle.c.
+ */
+//#define ALLOCATOR_HANDLES
+
+#ifdef ALLOCATOR_HANDLES
+/*! \def ALLOCATOR_HANDLES_CHUNK
+ * \brief Number of handles in first chunk taken from the heap, every next
+ * chunk is twice as large.
+ */
+#ifndef ALLOCATOR_HANDLES_CHUNK
+#define ALLOCATOR_HANDLES_CHUNK 32
+#endif
+#endif
+
+/*! \def ALLOCATOR_TRACE
+ * \brief Define (or add -DALLOCATOR_TRACE, or build with make TRACE=yes)
+ * to record every _amalloc(), _afree(), _arealloc() and _amemalign() of
+ * every heap as binary trace, which can be replayed by bench/replay.
+ * Records are put in lock-free ring buffer, which is flushed with
+ * _atracewrite() to file ALLOCATOR_TRACE_FILE. Requires trace.c.
+ */
+//#define ALLOCATOR_TRACE
+
+#ifdef ALLOCATOR_TRACE
+/*! \def ALLOCATOR_TRACE_RECORDS
+ * \brief Number of records in ring buffer, power of two. Half of the
+ * buffer is flushed at once.
+ */
+#ifndef ALLOCATOR_TRACE_RECORDS
+#define ALLOCATOR_TRACE_RECORDS 4096
+#endif
+
+/*! \def ALLOCATOR_TRACE_FILE
+ * \brief File written by default _atracewrite().
+ */
+#ifndef ALLOCATOR_TRACE_FILE
+#define ALLOCATOR_TRACE_FILE "yamal.trace"
+#endif
+#endif
+
+#ifdef ALLOCATOR_SLAB
+/*! \def ALLOCATOR_SLAB_SIZES
+ * \brief Comma separated, ascending slot sizes of slab classes. Every size
+ * has to be multiple of ALLOCATOR_ALIGNMENT and not smaller than a pointer.
+ */
+#ifndef ALLOCATOR_SLAB_SIZES
+#define ALLOCATOR_SLAB_SIZES 16, 32, 48, 64, 96, 128, 192, 256
+#endif
+
+/*! \def ALLOCATOR_SLAB_PAGE
+ * \brief Size of slab page. Page can't hold more than 65535 slots.
+ */
+#ifndef ALLOCATOR_SLAB_PAGE
+#define ALLOCATOR_SLAB_PAGE 4096
+#endif
+
+/*! \def ALLOCATOR_SLAB_ARENA
+ * \brief Bytes of the heap (but not more than quarter of it) reserved
+ * for slab pages on first small allocation.
+ */
+#ifndef ALLOCATOR_SLAB_ARENA
+#define ALLOCATOR_SLAB_ARENA (64 * 1024)
+#endif
+#endif
+
 
 /*! \fn void *_amalloc(size_t size)
  * \brief Memory allocation function.
@@ -52,18 +457,362 @@ void _afree(uintptr_t *ptr);
  */
 void *_arealloc(uintptr_t *ptr, size_t size);
 
+/*! \fn void *_acalloc(size_t nmemb, size_t size)
+ * \brief Allocates zeroed array of nmemb elements of given size.
+ */
+void *_acalloc(size_t nmemb, size_t size);
+
+/*! \fn void *_amemalign(size_t alignment, size_t size)
+ * \brief Allocates memory which address is multiple of alignment
+ *        (power of two). Returned pointer is freed with _afree().
+ */
+void *_amemalign(size_t alignment, size_t size);
+
+/*! \fn void *_aaligned_alloc(size_t alignment, size_t size)
+ * \brief Same as _amemalign(), named after C11 aligned_alloc().
+ */
+void *_aaligned_alloc(size_t alignment, size_t size);
+
+/*! \fn size_t _amalloc_usable_size(void *ptr)
+ * \brief Bytes of payload of allocated block which program can use,
+ *        named after malloc_usable_size() of glibc.
+ */
+size_t _amalloc_usable_size(void *ptr);
+
+/*! \fn size_t _amalloc_batch(size_t size, size_t count, void **out)
+ * \brief Allocates up to count blocks of size bytes at once, stores their
+ *        addresses in out. Returns number of blocks allocated.
+ */
+size_t _amalloc_batch(size_t size, size_t count, void **out);
+
+/*! \fn void _afree_batch(void **ptrs, size_t count)
+ * \brief Frees count blocks at once, NULL addresses are skipped.
+ */
+void _afree_batch(void **ptrs, size_t count);
+
 /*! \fn void _acopymem(void *dest, void *ptr, size_t amount)
  * \brief copy memory block form source to destination
  *        can be overwritten for performance reasons.
  */
 void __attribute__((weak)) _acopymem(t_MemNode *dest, t_MemNode *src);
 
+/*! \fn void _azeromem(t_MemNode *node)
+ * \brief zero whole payload of memory block,
+ *        can be overwritten for performance reasons.
+ */
+void __attribute__((weak)) _azeromem(t_MemNode *node);
+
+/*! \fn t_Heap *_aheapinit(void *buf, size_t size)
+ * \brief Makes independent heap in given buffer, returns its handle
+ *        or NULL if buffer is too small.
+ */
+t_Heap *_aheapinit(void *buf, size_t size);
+
+/*! \fn void *_ahmalloc(t_Heap *heap, size_t size)
+ * \brief Memory allocation from given heap.
+ */
+void *_ahmalloc(t_Heap *heap, size_t size);
+
+/*! \fn void _ahfree(t_Heap *heap, uintptr_t *ptr)
+ * \brief Frees memory allocated from given heap.
+ */
+void _ahfree(t_Heap *heap, uintptr_t *ptr);
+
+/*! \fn void *_ahrealloc(t_Heap *heap, uintptr_t *ptr, size_t size)
+ * \brief Realloc memory previously allocated from given heap.
+ */
+void *_ahrealloc(t_Heap *heap, uintptr_t *ptr, size_t size);
+
+/*! \fn void *_ahcalloc(t_Heap *heap, size_t nmemb, size_t size)
+ * \brief Allocates zeroed array from given heap.
+ */
+void *_ahcalloc(t_Heap *heap, size_t nmemb, size_t size);
+
+/*! \fn void *_ahmemalign(t_Heap *heap, size_t alignment, size_t size)
+ * \brief Allocates aligned memory from given heap.
+ */
+void *_ahmemalign(t_Heap *heap, size_t alignment, size_t size);
+
+/*! \fn size_t _ahmalloc_usable_size(t_Heap *heap, void *ptr)
+ * \brief Bytes of payload of block allocated from given heap.
+ */
+size_t _ahmalloc_usable_size(t_Heap *heap, void *ptr);
+
+/*! \fn size_t _ahmalloc_batch(t_Heap *heap, size_t size, size_t count, void **out)
+ * \brief Allocates up to count blocks of size bytes from given heap.
+ */
+size_t _ahmalloc_batch(t_Heap *heap, size_t size, size_t count, void **out);
+
+/*! \fn void _ahfree_batch(t_Heap *heap, void **ptrs, size_t count)
+ * \brief Frees count blocks of given heap at once.
+ */
+void _ahfree_batch(t_Heap *heap, void **ptrs, size_t count);
+
+/*! \fn int _asetpolicy(t_HeapPolicy policy)
+ * \brief Sets placement policy of default heap and its pools. Returns 0
+ *        if engine doesn't have it, TLSF and buddy have only HEAP_FIT_BEST,
+ *        which stands for their own placement.
+ */
+int _asetpolicy(t_HeapPolicy policy);
+
+/*! \fn int _ahsetpolicy(t_Heap *heap, t_HeapPolicy policy)
+ * \brief Sets placement policy of given heap and its pools.
+ */
+int _ahsetpolicy(t_Heap *heap, t_HeapPolicy policy);
+
+/*! \fn size_t _avalidate(t_HeapReport report)
+ * \brief Checks every block of default heap, reports errors to report
+ *        or, if it's NULL, to _aheaperror(). Returns number of errors.
+ */
+size_t _avalidate(t_HeapReport report);
+
+/*! \fn size_t _ahvalidate(t_Heap *heap, t_HeapReport report)
+ * \brief Checks every block of given heap and its pools.
+ */
+size_t _ahvalidate(t_Heap *heap, t_HeapReport report);
+
+/*! \fn void _aheaperror(t_Heap *heap, void *ptr, t_HeapError error)
+ * \brief Default report of heap errors, prints them if ALLOCATOR_USEREPORT
+ *        is defined. Can be overwritten, e.g. to log them or reset MCU.
+ */
+void __attribute__((weak)) _aheaperror(t_Heap *heap, void *ptr, t_HeapError error);
+
+#ifdef ALLOCATOR_THREADSAFE
+/*! \fn void _alock(t_Heap *heap)
+ * \brief Takes heap lock, can be overwritten with
+ *        lock of used RTOS.
+ */
+void __attribute__((weak)) _alock(t_Heap *heap);
+
+/*! \fn void _aunlock(t_Heap *heap)
+ * \brief Releases heap lock, can be overwritten along with _alock().
+ */
+void __attribute__((weak)) _aunlock(t_Heap *heap);
+
+/*! \fn void _athreadflush(void)
+ * \brief Returns all blocks cached by calling thread to the heap.
+ *        Called automatically when thread exits.
+ */
+void _athreadflush(void);
+
+/*! \fn void _aforklock(void)
+ * \brief Takes locks of default heap and its pools, to be called before
+ *        fork(), e.g. from pthread_atfork(_aforklock, _aforkunlock, _aforkunlock).
+ */
+void _aforklock(void);
+
+/*! \fn void _aforkunlock(void)
+ * \brief Releases locks taken by _aforklock() after fork().
+ */
+void _aforkunlock(void);
+#endif
+
+#ifdef ALLOCATOR_REMOTE_FREE
+/*! \fn void _ahsetowner(t_Heap *heap)
+ * \brief Makes calling thread owner of heap. From now on _ahfree() called
+ *        by other threads only pushes block on lock-free stack of the heap,
+ *        owner returns them to the engine on its next allocation.
+ */
+void _ahsetowner(t_Heap *heap);
+#endif
+
+#ifdef ALLOCATOR_STATS
+/*! \fn void _agetstats(t_HeapStats *stats)
+ * \brief Copies counters of default heap. Doesn't take heap lock,
+ *        so it may be called any time, from any thread.
+ */
+void _agetstats(t_HeapStats *stats);
+
+/*! \fn void _ahgetstats(t_Heap *heap, t_HeapStats *stats)
+ * \brief Copies counters of given heap.
+ */
+void _ahgetstats(t_Heap *heap, t_HeapStats *stats);
+#endif
+
+#ifdef ALLOCATOR_POOLS
+/*! \fn int _aaddpool(void *buf, size_t size)
+ * \brief Adds buffer as new pool of default heap. Returns 0 if buffer
+ *        is too small.
+ */
+int _aaddpool(void *buf, size_t size);
+
+/*! \fn int _ahaddpool(t_Heap *heap, void *buf, size_t size)
+ * \brief Adds buffer as new pool of given heap.
+ */
+int _ahaddpool(t_Heap *heap, void *buf, size_t size);
+
+/*! \fn void *_agrow(t_Heap *heap, size_t *size)
+ * \brief Called when heap and all its pools are full, should return
+ *        buffer of at least *size bytes for new pool and may set *size
+ *        to larger size of given buffer. Returns NULL by default, can be
+ *        overwritten e.g. with mmap().
+ */
+void * __attribute__((weak)) _agrow(t_Heap *heap, size_t *size);
+#endif
+
+#ifdef ALLOCATOR_MMAP
+/*! \fn size_t _atrim(void)
+ * \brief Gives pages inside free blocks of default heap back to the
+ *        system. Returns number of bytes released.
+ */
+size_t _atrim(void);
+
+/*! \fn size_t _ahtrim(t_Heap *heap)
+ * \brief Gives pages inside free blocks of given heap and its pools
+ *        back to the system.
+ */
+size_t _ahtrim(t_Heap *heap);
+#endif
+
+#ifdef ALLOCATOR_PERSIST
+/*! \fn t_Heap *_apersistopen(const char *path, size_t size)
+ * \brief Maps file (e.g. in /dev/shm for shared memory) as persistent heap,
+ *        file which doesn't exist or is empty is made size bytes large.
+ *        Returns NULL if file can't be mapped or doesn't hold valid heap.
+ */
+t_Heap *_apersistopen(const char *path, size_t size);
+
+/*! \fn t_Heap *_apersistattach(void *base, size_t size, int reset)
+ * \brief Uses memory mapped by caller as persistent heap, zeroed memory
+ *        is made new heap. Reset is set when no other process uses it,
+ *        its lock is made again then and heap is recovered if needed.
+ */
+t_Heap *_apersistattach(void *base, size_t size, int reset);
+
+/*! \fn void _apersistclose(t_Heap *heap)
+ * \brief Drops handle of persistent heap, unmaps it if it was opened
+ *        by _apersistopen(). Heap itself stays as it is.
+ */
+void _apersistclose(t_Heap *heap);
+
+/*! \fn int _apersistsync(t_Heap *heap)
+ * \brief Writes heap opened by _apersistopen() to its file, returns 0 on success.
+ */
+int _apersistsync(t_Heap *heap);
+
+/*! \fn void *_apersistroot(t_Heap *heap)
+ * \brief Returns root object of persistent heap, NULL if it's not set.
+ */
+void *_apersistroot(t_Heap *heap);
+
+/*! \fn void _apersistsetroot(t_Heap *heap, void *ptr)
+ * \brief Sets root object, the one found by _apersistroot() after heap is
+ *        opened again, ptr has to lie in the heap or be NULL.
+ */
+void _apersistsetroot(t_Heap *heap, void *ptr);
+#endif
+
+#ifdef ALLOCATOR_REGION
+/*! \fn t_Region *_aregioninit(t_Heap *heap, size_t size)
+ * \brief Allocates region of size bytes from given heap, or default heap
+ *        if heap is NULL. Returns NULL if there is no memory for it.
+ */
+t_Region *_aregioninit(t_Heap *heap, size_t size);
+
+/*! \fn void *_aregionalloc(t_Region *region, size_t size)
+ * \brief Takes size bytes, aligned to ALLOCATOR_ALIGNMENT, from region.
+ *        Returns NULL if region is full.
+ */
+void *_aregionalloc(t_Region *region, size_t size);
+
+/*! \fn size_t _aregionmark(t_Region *region)
+ * \brief Returns mark of current top of region.
+ */
+size_t _aregionmark(t_Region *region);
+
+/*! \fn void _aregionrollback(t_Region *region, size_t mark)
+ * \brief Releases everything taken from region after mark was made.
+ */
+void _aregionrollback(t_Region *region, size_t mark);
+
+/*! \fn void _aregionreset(t_Region *region)
+ * \brief Releases everything taken from region.
+ */
+void _aregionreset(t_Region *region);
+
+/*! \fn void _aregionfree(t_Region *region)
+ * \brief Returns region to its heap.
+ */
+void _aregionfree(t_Region *region);
+#endif
+
+#ifdef ALLOCATOR_HANDLES
+/*! \fn t_Handle _amallochandle(size_t size)
+ * \brief Allocates movable block from default heap, returns its handle
+ *        or NULL if there is no memory.
+ */
+t_Handle _amallochandle(size_t size);
+
+/*! \fn t_Handle _ahmallochandle(t_Heap *heap, size_t size)
+ * \brief Allocates movable block from given heap.
+ */
+t_Handle _ahmallochandle(t_Heap *heap, size_t size);
+
+/*! \fn void *_alockhandle(t_Handle handle)
+ * \brief Locks block in place and returns its address, valid until
+ *        handle is unlocked as many times as it was locked.
+ */
+void *_alockhandle(t_Handle handle);
+
+/*! \fn void _aunlockhandle(t_Handle handle)
+ * \brief Unlocks block, lets compaction move it again.
+ */
+void _aunlockhandle(t_Handle handle);
+
+/*! \fn int _areallochandle(t_Handle handle, size_t size)
+ * \brief Resizes block of unlocked handle. Returns 0 if handle is locked
+ *        or there is no memory, block is left untouched then.
+ */
+int _areallochandle(t_Handle handle, size_t size);
+
+/*! \fn void _afreehandle(t_Handle handle)
+ * \brief Frees block and its handle.
+ */
+void _afreehandle(t_Handle handle);
+
+/*! \fn size_t _acompact(void)
+ * \brief Moves unlocked blocks of handles down default heap, joining
+ *        free space between them. Returns largest payload which can be
+ *        allocated afterwards.
+ */
+size_t _acompact(void);
+
+/*! \fn size_t _ahcompact(t_Heap *heap)
+ * \brief Compacts given heap and its pools.
+ */
+size_t _ahcompact(t_Heap *heap);
+#endif
+
+#ifdef ALLOCATOR_TRACE
+/*! \fn void _atracewrite(const void *buf, size_t len)
+ * \brief Writes part of trace, by default appends it to ALLOCATOR_TRACE_FILE,
+ *        can be overwritten e.g. to send trace over UART.
+ */
+void __attribute__((weak)) _atracewrite(const void *buf, size_t len);
+
+/*! \fn uint64_t _atraceclock(void)
+ * \brief Timestamp of trace record, nanoseconds of monotonic clock by default,
+ *        can be overwritten with timer of used MCU.
+ */
+uint64_t __attribute__((weak)) _atraceclock(void);
+
+/*! \fn void _atracesync(void)
+ * \brief Flushes all records from ring buffer. Called at exit.
+ */
+void _atracesync(void);
+#endif
+
 /*! \fn void _printAllocs(void)
  * \brief Prints current memory usage and statistics.
  */
 void _printAllocs(uintptr_t *ptr);
 
-#ifdef _cplusplus
+/*! \fn void _printHeapAllocs(t_Heap *heap, uintptr_t *ptr)
+ * \brief Prints memory usage and statistics of given heap.
+ */
+void _printHeapAllocs(t_Heap *heap, uintptr_t *ptr);
+
+#ifdef __cplusplus
 }
 #endif
 #endif
@@ -0,0 +1,161 @@
+#ifndef __ALLOCATOR_HPP_
+#define __ALLOCATOR_HPP_
+
+/*
+ * allocator.hpp
+ * C++ adapters which put selected containers on YAMAL heap, without
+ * redefining global new and delete.
+ * yamal::allocator<T> can be given to any standard container,
+ * yamal::heap_resource (C++17) to any std::pmr container.
+ * Both work either on default heap or on heap made by _aheapinit(),
+ * requested alignment is passed to _ahmemalign().
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define ALLOCATOR_PMR
+#endif
+#endif
+
+namespace yamal
+{
+
+/*! \fn void *allocate(t_Heap *heap, std::size_t bytes, std::size_t alignment)
+ * \brief Allocates from given heap, or default heap if heap is nullptr.
+ * Throws std::bad_alloc when heap is full.
+ */
+inline void *allocate(t_Heap *heap, std::size_t bytes, std::size_t alignment)
+{
+    void *ptr;
+
+    //zero size request of C API returns first block, which can't be freed
+    if (bytes == 0)
+        bytes = 1;
+
+    ptr = (heap ? _ahmemalign(heap, alignment, bytes) : _amemalign(alignment, bytes));
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+/*! \fn void deallocate(t_Heap *heap, void *ptr)
+ * \brief Frees memory allocated by yamal::allocate().
+ */
+inline void deallocate(t_Heap *heap, void *ptr) noexcept
+{
+    if (heap)
+        _ahfree(heap, static_cast<uintptr_t*>(ptr));
+    else
+        _afree(static_cast<uintptr_t*>(ptr));
+}
+
+/*! \class allocator
+ * \brief Allocator for standard containers. Default constructed one
+ * is stateless and uses default heap, constructed with t_Heap* uses
+ * that heap. Instances compare equal when they use the same heap.
+ */
+template <class T>
+class allocator
+{
+public:
+    typedef T value_type;
+
+    allocator() noexcept : _heap(nullptr) {}
+    explicit allocator(t_Heap *heap) noexcept : _heap(heap) {}
+
+    template <class U>
+    allocator(const allocator<U> &other) noexcept : _heap(other.heap()) {}
+
+    T *allocate(std::size_t n)
+    {
+        if (n > SIZE_MAX / sizeof(T))
+            throw std::bad_array_new_length();
+        return static_cast<T*>(yamal::allocate(_heap, n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *ptr, std::size_t) noexcept
+    {
+        yamal::deallocate(_heap, ptr);
+    }
+
+    t_Heap *heap() const noexcept
+    {
+        return _heap;
+    }
+
+private:
+    t_Heap *_heap;
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return a.heap() == b.heap();
+}
+
+template <class T, class U>
+bool operator!=(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return a.heap() != b.heap();
+}
+
+#ifdef ALLOCATOR_PMR
+/*! \class heap_resource
+ * \brief std::pmr::memory_resource on default heap, on given heap, or on
+ * new heap made in given buffer.
+ */
+class heap_resource : public std::pmr::memory_resource
+{
+public:
+    heap_resource() noexcept : _heap(nullptr) {}
+    explicit heap_resource(t_Heap *heap) noexcept : _heap(heap) {}
+
+    heap_resource(void *buf, std::size_t size) : _heap(_aheapinit(buf, size))
+    {
+        if (!_heap)
+            throw std::bad_alloc();
+    }
+
+    t_Heap *heap() const noexcept
+    {
+        return _heap;
+    }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return yamal::allocate(_heap, bytes, alignment);
+    }
+
+    void do_deallocate(void *ptr, std::size_t, std::size_t) override
+    {
+        yamal::deallocate(_heap, ptr);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        const heap_resource *res = dynamic_cast<const heap_resource*>(&other);
+        return res && res->_heap == _heap;
+    }
+
+private:
+    t_Heap *_heap;
+};
+#endif
+
+}
+
+#endif
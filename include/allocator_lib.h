@@ -4,11 +4,18 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#ifdef _cplusplus
+#ifdef ALLOCATOR_THREADSAFE
+#include <pthread.h>
+#endif
+
+#ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef struct _mem_node t_MemNode;
+typedef struct _heap t_Heap;
+typedef struct _slab t_Slab;
+typedef struct _handle_chunk t_HandleChunk;
 
 /*! \def BLOCK_FREE
  * \brief Marking of block which is free and available for allocation
@@ -16,18 +23,64 @@ typedef struct _mem_node t_MemNode;
 #define BLOCK_FREE 0
 
 #define OFFSET(block, offset) ((uintptr_t)block + (uintptr_t)(offset))
-#define SSIZE (sizeof(t_MemNode))
+#define SSIZE ((sizeof(t_MemNode) + ALLOCATOR_ALIGNMENT - 1) & ~(size_t)(ALLOCATOR_ALIGNMENT - 1))
 
 #define MARK_BLOCKFREE(NODE) (NODE->size = -(_abs(NODE->size)))
 #define MARK_BLOCKUSED(NODE) (NODE->size = (_abs(NODE->size)))
-#define SET_BLOCKFREE(NODE, isize) NODE->size = -isize
+#define SET_BLOCKFREE(NODE, isize) NODE->size = -(isize)
 #define SET_BLOCKUSED(NODE, isize) NODE->size = isize
 
 #define BLOCK_ISFREE(NODE) (NODE->size < 0)
 #define BLOCK_ISUSED(NODE) (NODE->size > 0)
 
 #define GET_BLOCKSIZE(NODE) (_abs(NODE->size))
-#define SET_BLOCKSIZE(NODE, isize) (NODE->size = (NODE->size > 0 ? isize : -isize ))
+#define SET_BLOCKSIZE(NODE, isize) (NODE->size = (NODE->size > 0 ? (isize) : -(isize) ))
+
+/*
+ * Links to following and previous block. In compact node they are kept
+ * as distance from the node, 0 for none, so they don't depend on where
+ * the heap lies.
+ */
+#ifdef ALLOCATOR_COMPACT
+#define GET_NEXT(NODE) ((NODE)->next ? (t_MemNode*)OFFSET(NODE, (NODE)->next) : NULL)
+#define SET_NEXT(NODE, NEXT) ((NODE)->next = ((NEXT) ? (uint32_t)((uintptr_t)(NEXT) - (uintptr_t)(NODE)) : 0))
+#define GET_PREV(NODE) ((NODE)->prev ? (t_MemNode*)((uintptr_t)(NODE) - (NODE)->prev) : NULL)
+#define SET_PREV(NODE, PREV) ((NODE)->prev = ((PREV) ? (uint32_t)((uintptr_t)(NODE) - (uintptr_t)(PREV)) : 0))
+#else
+#define GET_NEXT(NODE) ((NODE)->next)
+#define SET_NEXT(NODE, NEXT) ((NODE)->next = (NEXT))
+#define GET_PREV(NODE) ((NODE)->prev)
+#define SET_PREV(NODE, PREV) ((NODE)->prev = (PREV))
+#endif
+
+/*
+ * Canary of used block is made of its size, so both overwritten
+ * header and changed size are found. It's set whenever block is given
+ * out or resized, free blocks don't keep it. It doesn't depend on
+ * address, so it stays valid in heap mapped elsewhere.
+ */
+#ifdef ALLOCATOR_CANARY
+#define CANARY(NODE) ((uintptr_t)ALLOCATOR_CANARY_KEY ^ (uintptr_t)GET_BLOCKSIZE(NODE))
+#define CANARY_SET(NODE) ((NODE)->canary = CANARY(NODE))
+/*
+ * Block kept in thread cache stays used for the engine, its canary is
+ * inverted, so block freed again while it's cached is told apart.
+ */
+#define CANARY_CACHED(NODE) (CANARY(NODE) ^ (uintptr_t)0xFFFFFFFFu)
+#define CANARY_CACHE(NODE) ((NODE)->canary = CANARY_CACHED(NODE))
+#else
+#define CANARY_SET(NODE)
+#define CANARY_CACHE(NODE)
+#endif
+
+/*! \def NODE_MAXSIZE
+ * \brief Largest block size node can hold, heap larger than that is trimmed to it.
+ */
+#ifdef ALLOCATOR_COMPACT
+#define NODE_MAXSIZE ((size_t)INT32_MAX & ~(size_t)(ALLOCATOR_ALIGNMENT - 1))
+#else
+#define NODE_MAXSIZE ((size_t)INTPTR_MAX & ~(size_t)(ALLOCATOR_ALIGNMENT - 1))
+#endif
 
 #ifndef NDEBUG
 #define _assert(expr, NODE)							\
@@ -47,6 +100,40 @@ typedef struct _mem_node t_MemNode;
 #define ALIGN(NUMBER) ((NUMBER % ALLOCATOR_ALIGNMENT) ? \
         ((NUMBER + ALLOCATOR_ALIGNMENT) - (NUMBER % ALLOCATOR_ALIGNMENT)) : NUMBER);
 
+/*! \def ALIGN_UP(NUMBER, A)
+ * \brief Rounds NUMBER up to multiple of A, which is power of two.
+ */
+#define ALIGN_UP(NUMBER, A) (((uintptr_t)(NUMBER) + (A) - 1) & ~((uintptr_t)(A) - 1))
+
+#ifdef ALLOCATOR_TRACE
+#define TRACE(OP, PTR, ARG, SIZE) _traceRecord(OP, PTR, ARG, SIZE)
+#else
+#define TRACE(OP, PTR, ARG, SIZE)
+#endif
+
+#ifdef ALLOCATOR_STATS
+#define STAT_INIT(HEAP) _statInit(HEAP)
+#define STAT_OP(HEAP, FIELD, DONE) _statOp(HEAP, &(HEAP)->stats.FIELD, DONE)
+#define STAT_USE(HEAP, SIZE, BLOCKS) _statUse(HEAP, SIZE, BLOCKS)
+#define STAT_ENGINE(HEAP, SIZE) _statEngine(HEAP, SIZE)
+#else
+#define STAT_INIT(HEAP)
+#define STAT_OP(HEAP, FIELD, DONE)
+#define STAT_USE(HEAP, SIZE, BLOCKS) ((void)(SIZE))
+#define STAT_ENGINE(HEAP, SIZE) ((void)(SIZE))
+#endif
+
+#if defined(ALLOCATOR_PERSIST)
+#define HEAP_LOCK(HEAP) ((HEAP)->persist ? _persistLock(HEAP) : _alock(HEAP))
+#define HEAP_UNLOCK(HEAP) ((HEAP)->persist ? _persistUnlock(HEAP) : _aunlock(HEAP))
+#elif defined(ALLOCATOR_THREADSAFE)
+#define HEAP_LOCK(HEAP) _alock(HEAP)
+#define HEAP_UNLOCK(HEAP) _aunlock(HEAP)
+#else
+#define HEAP_LOCK(HEAP)
+#define HEAP_UNLOCK(HEAP)
+#endif
+
 #ifdef ALLOCATOR_USEREPORT
 /*! \def tprintf(format, ...)
  * \brief Change this to something else which will work like printf
@@ -57,13 +144,416 @@ typedef struct _mem_node t_MemNode;
 #endif
 
 
+#ifdef ALLOCATOR_COMPACT
+/*! \struct t_MemNode
+ * \brief Compact node, links are 32 bit distances to neighbouring blocks,
+ * access them with GET_NEXT()/SET_NEXT() and GET_PREV()/SET_PREV().
+ */
+typedef struct _mem_node
+{
+#ifdef ALLOCATOR_CANARY
+    uint32_t canary;
+#endif
+    uint32_t next;
+    int32_t  size;
+#if defined(ALLOCATOR_ENGINE_TLSF) || defined(ALLOCATOR_BOUNDARY_TAGS)
+    uint32_t prev;
+#endif
+} t_MemNode;
+#else
 typedef struct _mem_node
 {
+#ifdef ALLOCATOR_CANARY
+    uintptr_t canary;
+#endif
     t_MemNode *next;
     intptr_t  size;
+#if defined(ALLOCATOR_ENGINE_TLSF) || defined(ALLOCATOR_BOUNDARY_TAGS)
+    t_MemNode *prev;
+#endif
 } __attribute__((packed)) t_MemNode;
+#endif
+
+/*! \struct t_FreeLinks
+ * \brief Links of free list, kept in unused space right after node of free block.
+ */
+typedef struct _free_links
+{
+    t_MemNode *nextfree;
+    t_MemNode *prevfree;
+} t_FreeLinks;
+
+#define FREELINKS(NODE) ((t_FreeLinks*)OFFSET(NODE, SSIZE))
+
+/*! \def MINBLOCK
+ * \brief Smallest block able to hold its free list links.
+ */
+#define MINBLOCK ((SSIZE + sizeof(t_FreeLinks) + ALLOCATOR_ALIGNMENT - 1) & ~(size_t)(ALLOCATOR_ALIGNMENT - 1))
+
+#if defined(ALLOCATOR_ENGINE_TLSF)
+#define SL_COUNT (1 << ALLOCATOR_TLSF_SLBITS)
+
+#define ALIGN_LOG2 (ALLOCATOR_ALIGNMENT >= 64 ? 6 : \
+                    ALLOCATOR_ALIGNMENT >= 32 ? 5 : \
+                    ALLOCATOR_ALIGNMENT >= 16 ? 4 : \
+                    ALLOCATOR_ALIGNMENT >= 8 ? 3 : 2)
+
+/*
+ * Blocks smaller than 1 << FL_SHIFT are kept in first list,
+ * divided linearly in steps of ALLOCATOR_ALIGNMENT.
+ */
+#define FL_SHIFT (ALLOCATOR_TLSF_SLBITS + ALIGN_LOG2)
+#define FL_COUNT (ALLOCATOR_TLSF_FLMAX - FL_SHIFT + 1)
+
+/*! \struct t_Engine
+ * \brief TLSF engine state, bitmaps and heads of segregated lists.
+ */
+typedef struct _engine
+{
+    uint32_t flbitmap;
+    uint32_t slbitmap[FL_COUNT];
+    t_MemNode *freelists[FL_COUNT][SL_COUNT];
+} t_Engine;
+#elif defined(ALLOCATOR_ENGINE_BUDDY)
+#define MAXORDERS (sizeof(size_t) * 8)
+
+/*! \struct t_Engine
+ * \brief Buddy engine state, bitmaps and lists of free blocks of each order,
+ * largest alignment of payload blocks have.
+ */
+typedef struct _engine
+{
+    uint8_t *base;
+    size_t usable;
+    size_t align;
+    int minorder, maxorder;
+    uint64_t ordermap;
+    uint32_t *freemaps[MAXORDERS];
+    t_MemNode *freelists[MAXORDERS];
+} t_Engine;
+#else
+/*! \struct t_Engine
+ * \brief List engine state, head of free list if ALLOCATOR_FREE_LIST is defined,
+ * block where last HEAP_FIT_NEXT search stopped, size of largest free block
+ * and size no other free block exceeds if ALLOCATOR_STATS is defined.
+ */
+typedef struct _engine
+{
+    t_MemNode *freelist;
+    t_MemNode *rover;
+#ifdef ALLOCATOR_STATS
+    size_t largest;
+    size_t second;
+#endif
+} t_Engine;
+#endif
+
+#ifdef ALLOCATOR_REMOTE_FREE
+/*! \struct t_Remote
+ * \brief Owner of the heap and stack of blocks freed by other threads,
+ * linked through their payload. Address given for zero size, which
+ * is never pushed, is copied here. Padded to cache line of its own, so
+ * pushing block doesn't invalidate lines of the rest of heap state.
+ */
+typedef struct _remote
+{
+    uint8_t before[ALLOCATOR_CACHELINE];
+    void *owner;
+    uintptr_t *head;
+    uintptr_t *zero;
+    uint8_t after[ALLOCATOR_CACHELINE - 3 * sizeof(void*)];
+} t_Remote;
+
+#define REMOTE_NEXT(MEM) (*(uintptr_t**)(MEM))
+#endif
+
+#ifdef ALLOCATOR_PERSIST
+/*! \struct t_Persist
+ * \brief Header of persistent heap, kept at the start of mapped memory,
+ * blocks follow it. Header holds no address, only offsets from itself.
+ * Checksum covers fields between magic and itself, which never change. Busy is set
+ * while heap lock is taken, so heap left in the middle of operation
+ * is recovered when it's opened again.
+ */
+typedef struct _persist
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    uint32_t config;
+    uint32_t checksum;
+    uint64_t root;
+    uint32_t busy;
+    pthread_mutex_t lock;
+} t_Persist;
+#endif
+
+/*! \struct t_Heap
+ * \brief State of one heap. Default heap is made of _a_heapstart and
+ * _a_heapsize, others are placed at the start of buffer given to _aheapinit().
+ * Pools added to the heap are heaps as well, linked in pool list, every
+ * one points to the heap it was added to by base. Persistent heap has
+ * its state in process, made again from header and blocks by every one.
+ */
+struct _heap
+{
+    uint8_t *start;
+    size_t size;
+    t_MemNode *firstblock;
+    t_Engine engine;
+    uint8_t policy;
+#ifdef ALLOCATOR_SLAB
+    t_Slab *slab;
+    uint8_t noslab;
+#endif
+#ifdef ALLOCATOR_STATS
+    t_HeapStats stats;
+#endif
+#ifdef ALLOCATOR_THREADSAFE
+    pthread_mutex_t lock;
+#endif
+#ifdef ALLOCATOR_POOLS
+    t_Heap *base;
+    t_Heap *pool;
+#endif
+#ifdef ALLOCATOR_REMOTE_FREE
+    t_Remote remote;
+#endif
+#ifdef ALLOCATOR_PERSIST
+    t_Persist *persist;
+#endif
+#ifdef ALLOCATOR_HANDLES
+    t_HandleChunk *handles;
+    t_Handle freehandle;
+#endif
+};
+
+#ifdef ALLOCATOR_POOLS
+#define BASEHEAP(HEAP) ((HEAP)->base)
+#else
+#define BASEHEAP(HEAP) (HEAP)
+#endif
+
+/*
+ * Engine interface. Every engine (list.c, tlsf.c, buddy.c) implements below
+ * functions, public API in allocator.c is built on top of them.
+ * All sizes given to engine include SSIZE and are already aligned.
+ * Node takes SSIZE bytes, which is multiple of ALLOCATOR_ALIGNMENT, so
+ * payload of every block is aligned as long as block itself is.
+ */
+
+/*! \fn t_MemNode *_engineInit(t_Heap *heap)
+ * \brief Builds initial free block(s) over the heap, returns first block.
+ */
+t_MemNode *_engineInit(t_Heap *heap);
+
+/*! \fn t_MemNode *_engineAlloc(t_Heap *heap, size_t size)
+ * \brief Finds free block of at least size bytes, marks it as used.
+ */
+t_MemNode *_engineAlloc(t_Heap *heap, size_t size);
+
+/*! \fn t_MemNode *_engineAllocAligned(t_Heap *heap, size_t size, size_t alignment)
+ * \brief Like _engineAlloc(), but payload of the block is aligned to
+ * alignment, power of two larger than ALLOCATOR_ALIGNMENT.
+ */
+t_MemNode *_engineAllocAligned(t_Heap *heap, size_t size, size_t alignment);
+
+/*! \fn void _engineFree(t_Heap *heap, t_MemNode *node)
+ * \brief Returns used block to engine, consolidating it with free neighbours.
+ */
+void _engineFree(t_Heap *heap, t_MemNode *node);
+
+/*! \fn t_MemNode *_engineResize(t_Heap *heap, t_MemNode *node, size_t size)
+ * \brief Resizes used block in place, growing it into free neighbours if
+ * needed. When block is extended backward its payload is moved to the new
+ * start. Returns node (possibly moved) or NULL if it's not possible.
+ */
+t_MemNode *_engineResize(t_Heap *heap, t_MemNode *node, size_t size);
+
+/*! \fn size_t _engineAllocBatch(t_Heap *heap, size_t size, size_t count, t_MemNode **nodes)
+ * \brief Allocates up to count blocks of size bytes, stores them in nodes.
+ * Returns number of blocks allocated, less than count when heap is full.
+ */
+size_t _engineAllocBatch(t_Heap *heap, size_t size, size_t count, t_MemNode **nodes);
+
+/*! \fn void _engineFreeBatch(t_Heap *heap, t_MemNode **nodes, size_t count)
+ * \brief Returns count used blocks to engine, consolidating them with
+ * free neighbours.
+ */
+void _engineFreeBatch(t_Heap *heap, t_MemNode **nodes, size_t count);
+
+/*! \fn int _engineSetPolicy(t_Heap *heap, t_HeapPolicy policy)
+ * \brief Sets placement policy of the heap, returns 0 if engine doesn't
+ * have it. Heap lock has to be taken.
+ */
+int _engineSetPolicy(t_Heap *heap, t_HeapPolicy policy);
+
+#ifdef ALLOCATOR_HANDLES
+/*! \fn size_t _engineCompact(t_Heap *heap)
+ * \brief Moves blocks which _handleMove() lets go down the heap, joining
+ * free space. Returns size of largest free block. Only list engine has it.
+ */
+size_t _engineCompact(t_Heap *heap);
+#endif
 
+#ifdef ALLOCATOR_STATS
+/*! \fn size_t _engineLargest(t_Heap *heap)
+ * \brief Size of largest block, including node, engine is able to allocate
+ * at the moment, or 0 if there are no free blocks.
+ */
+size_t _engineLargest(t_Heap *heap);
+#endif
+
+/*! \fn void _amemcopy(void *dest, const void *src, size_t n)
+ * \brief Copies n bytes, dest can overlap src but must not lie above it.
+ */
+void _amemcopy(void *dest, const void *src, size_t n);
+
+/*! \fn void _amemfill(void *dest, uint8_t value, size_t n)
+ * \brief Sets n bytes at dest to value.
+ */
+void _amemfill(void *dest, uint8_t value, size_t n);
+
+#ifdef ALLOCATOR_THREADSAFE
+/*! \fn t_MemNode *_tcacheAlloc(t_Heap *heap, size_t size)
+ * \brief Takes block of at least size bytes of payload from thread cache,
+ * refilling it from the heap if empty. Returns NULL if size isn't cached.
+ */
+t_MemNode *_tcacheAlloc(t_Heap *heap, size_t size);
+
+/*! \fn int _tcacheFree(t_Heap *heap, t_MemNode *node)
+ * \brief Puts used block in thread cache, returns 0 if block isn't cached.
+ */
+int _tcacheFree(t_Heap *heap, t_MemNode *node);
+#endif
+
+#ifdef ALLOCATOR_REMOTE_FREE
+/*! \fn int _remoteFree(t_Heap *heap, uintptr_t *mem)
+ * \brief Pushes block on remote stack of heap owned by other thread,
+ * returns 0 if heap has no owner or it's owned by calling thread.
+ */
+int _remoteFree(t_Heap *heap, uintptr_t *mem);
+
+/*! \fn uintptr_t *_remoteTake(t_Heap *heap, int any)
+ * \brief Takes whole remote stack, if calling thread owns the heap or any
+ * is set. Returns NULL if stack is empty.
+ */
+uintptr_t *_remoteTake(t_Heap *heap, int any);
+#endif
+
+#ifdef ALLOCATOR_MMAP
+/*! \fn void *_mmapAlloc(size_t alignment, size_t size)
+ * \brief Maps block of its own, returns NULL if alignment is larger
+ * than page or mapping failed.
+ */
+void *_mmapAlloc(size_t alignment, size_t size);
+
+/*! \fn void _mmapFree(void *mem)
+ * \brief Unmaps block given by _mmapAlloc().
+ */
+void _mmapFree(void *mem);
+
+/*! \fn void *_mmapResize(void *mem, size_t size)
+ * \brief Resizes mapped block, moving it if needed. Returns NULL if it
+ * can't be resized, block is left untouched then.
+ */
+void *_mmapResize(void *mem, size_t size);
+
+/*! \fn size_t _mmapTrim(t_Heap *heap)
+ * \brief Releases pages inside free blocks, returns number of bytes
+ * released. Heap lock has to be taken.
+ */
+size_t _mmapTrim(t_Heap *heap);
+#endif
+
+#ifdef ALLOCATOR_PERSIST
+/*! \fn void _persistLock(t_Heap *heap)
+ * \brief Takes lock shared by all processes using persistent heap,
+ * recovers heap left by process which died holding it.
+ */
+void _persistLock(t_Heap *heap);
+
+/*! \fn void _persistUnlock(t_Heap *heap)
+ * \brief Releases lock of persistent heap.
+ */
+void _persistUnlock(t_Heap *heap);
+#endif
+
+#ifdef ALLOCATOR_HANDLES
+/*! \fn int _handleMove(t_Heap *heap, t_MemNode *node, t_MemNode *to)
+ * \brief Tells if used block may be moved to address to, points its
+ * handle there if so. Heap lock has to be taken.
+ */
+int _handleMove(t_Heap *heap, t_MemNode *node, t_MemNode *to);
+#endif
+
+#ifdef ALLOCATOR_STATS
+/*! \fn void _statInit(t_Heap *heap)
+ * \brief Sets counters of heap which engine was just initialized.
+ */
+void _statInit(t_Heap *heap);
+
+/*! \fn size_t _statAdd(size_t *counter, size_t n)
+ * \brief Adds n to counter, atomically if heap can be used by many threads.
+ * Returns new value.
+ */
+size_t _statAdd(size_t *counter, size_t n);
+
+/*! \fn void _statOp(t_Heap *heap, size_t *counter, int done)
+ * \brief Counts call of public function, failed one if done is 0.
+ */
+void _statOp(t_Heap *heap, size_t *counter, int done);
+
+/*! \fn void _statUse(t_Heap *heap, intptr_t size, int blocks)
+ * \brief Adds size bytes and blocks (both may be negative) to those in use.
+ */
+void _statUse(t_Heap *heap, intptr_t size, int blocks);
+
+/*! \fn void _statEngine(t_Heap *heap, intptr_t size)
+ * \brief Engine took size bytes of free blocks (gave back, if negative).
+ * Heap lock has to be taken.
+ */
+void _statEngine(t_Heap *heap, intptr_t size);
+#endif
+
+#ifdef ALLOCATOR_TRACE
+/*! \fn void _traceRecord(t_TraceOp op, void *ptr, uintptr_t arg, size_t size)
+ * \brief Puts record in trace ring buffer.
+ */
+void _traceRecord(t_TraceOp op, void *ptr, uintptr_t arg, size_t size);
+#endif
+
+#ifdef ALLOCATOR_SLAB
+/*! \fn void *_slabAlloc(t_Heap *heap, size_t size)
+ * \brief Allocates slab slot, returns NULL if size isn't served by slab.
+ */
+void *_slabAlloc(t_Heap *heap, size_t size);
+
+/*! \fn size_t _slabFree(t_Heap *heap, void *ptr)
+ * \brief Frees slab slot, returns its size or 0 if ptr isn't slab object
+ *        or, with ALLOCATOR_CANARY, slot was freed already.
+ */
+size_t _slabFree(t_Heap *heap, void *ptr);
+
+/*! \fn size_t _slabSize(t_Heap *heap, void *ptr)
+ * \brief Returns size of slab slot or 0 if ptr isn't slab object,
+ *        heap lock isn't needed.
+ */
+size_t _slabSize(t_Heap *heap, void *ptr);
+
+/*! \fn int _slabServes(t_Heap *heap, size_t size)
+ * \brief Tells if size may be served by slab, heap lock isn't needed.
+ */
+int _slabServes(t_Heap *heap, size_t size);
+#endif
+
+#ifdef ALLOCATOR_CANARY
+#define guard(HEAP, NODE) ((void)(HEAP), (void)(NODE))
+#else
+t_MemNode *guard(t_Heap *heap, t_MemNode *node);
+#endif
 uintptr_t _abs(intptr_t v);
+size_t _alignGap(t_MemNode *node, size_t alignment);
 
 void _assert_fail(const char *assertion,
                   const char *file,
@@ -72,7 +562,7 @@ void _assert_fail(const char *assertion,
                   t_MemNode *node
                  );
 
-#ifdef _cplusplus
+#ifdef __cplusplus
 }
 #endif
 
@@ -3,6 +3,8 @@
  * Implementation of malloc/free/realloc/calloc functions
  * All allocated blocks size is increased by
  * header which will make sngly linked list of memory blocks.
+ * Searching and consolidating blocks is done by engine
+ * selected at build time (list.c, tlsf.c or buddy.c).
  *
  * Author: Jarek Zok <jarekzok@gmail.com>
  * Licence: MIT https://opensource.org/licenses/MIT
@@ -20,7 +22,47 @@
 #include <stdio.h>
 #endif
 
-static t_MemNode *firstblock = NULL;
+static t_Heap defaultheap = {
+#ifdef ALLOCATOR_THREADSAFE
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+#endif
+#ifdef ALLOCATOR_POOLS
+    .base = &defaultheap,
+#endif
+};
+
+#ifdef ALLOCATOR_POOLS
+#define NEXTPOOL(HEAP) __atomic_load_n(&(HEAP)->pool, __ATOMIC_ACQUIRE)
+#define POOL_OF(HEAP, MEM) _poolOf(HEAP, MEM)
+
+static t_Heap *_poolOf(t_Heap *heap, void *mem);
+static void *_poolAlloc(t_Heap *heap, t_Heap *skip, size_t alignment, size_t size);
+#else
+#define NEXTPOOL(HEAP) NULL
+#define POOL_OF(HEAP, MEM) (HEAP)
+#endif
+
+#ifdef ALLOCATOR_CANARY
+#define CANARY_OK(HEAP, NODE) _canaryCheck(HEAP, NODE)
+#else
+#define CANARY_OK(HEAP, NODE) 1
+#endif
+
+/*! \def BATCH_NODES
+ * \brief Blocks given to engine at once by batch allocation and free.
+ */
+#define BATCH_NODES 64
+
+#ifdef ALLOCATOR_MMAP
+#define MAPPED(HEAP, MEM) _isMapped(HEAP, MEM)
+#define MAP_ALLOC(HEAP, ALIGNMENT, SIZE) _mapAlloc(HEAP, ALIGNMENT, SIZE)
+
+static int _isMapped(t_Heap *heap, void *mem);
+static void *_mapAlloc(t_Heap *heap, size_t alignment, size_t size);
+#else
+#define MAPPED(HEAP, MEM) 0
+#define MAP_ALLOC(HEAP, ALIGNMENT, SIZE) NULL
+#endif
 
 void _assert_fail(const char *assertion,
                   const char *file,
@@ -34,19 +76,20 @@ void _assert_fail(const char *assertion,
             "File:\t%s\n"
             "Line:\t%u\n"
             "Function:\t%s\n\n"
-            "Node:\t0x%08X\n"
-            "Size:\t%u\n"
+            "Node:\t%p\n"
+            "Size:\t%jd\n"
             "------\n",
                 assertion,
                 file,
                 line,
                 function,
-                node,
-                (node ? node->size : 0));
+                (void*)node,
+                (node ? (intmax_t)node->size : 0));
     while(1);
 }
 
-t_MemNode *guard(t_MemNode *node)
+#ifndef ALLOCATOR_CANARY
+t_MemNode *guard(t_Heap *heap, t_MemNode *node)
 {
     if (!node)
         return node;
@@ -55,24 +98,25 @@ t_MemNode *guard(t_MemNode *node)
     uintptr_t addr = (uintptr_t)node;
 
     _assert(node->size != 0, node);
-    _assert(size <= _a_heapsize, node);
-    _assert(addr >= (uintptr_t)_a_heapstart, node);
-    _assert(addr < ((uintptr_t)_a_heapstart + (uintptr_t)_a_heapsize), node);
+    _assert(size <= heap->size, node);
+    _assert(addr >= (uintptr_t)heap->start, node);
+    _assert(addr < ((uintptr_t)heap->start + (uintptr_t)heap->size), node);
 
-    if (node->next)
+    if (GET_NEXT(node))
     {
-        node = node->next;
+        node = GET_NEXT(node);
         size = GET_BLOCKSIZE(node);
         addr = (uintptr_t)node;
 
         _assert(node->size != 0, node);
-        _assert(size <= _a_heapsize, node);
-        _assert(addr >= (uintptr_t)_a_heapstart, node);
-        _assert(addr < ((uintptr_t)_a_heapstart + (uintptr_t)_a_heapsize), node);
+        _assert(size <= heap->size, node);
+        _assert(addr >= (uintptr_t)heap->start, node);
+        _assert(addr < ((uintptr_t)heap->start + (uintptr_t)heap->size), node);
     }
 
-    return node->next;
+    return GET_NEXT(node);
 }
+#endif
 
 uintptr_t _abs(intptr_t v)
 {
@@ -81,139 +125,219 @@ uintptr_t _abs(intptr_t v)
 }
 
 /**
- * \brief Naive implementation of function copying memory block.
- * Can be reimplementend in user library for better performance.
+ * \brief Default report of heap errors, prints them on USEREPORT output.
  */
-void __attribute__((weak)) _acopymem(t_MemNode *dest, t_MemNode *src)
+void __attribute__((weak)) _aheaperror(t_Heap *heap, void *ptr, t_HeapError error)
 {
-  size_t s = ((GET_BLOCKSIZE(dest) - SSIZE) > (GET_BLOCKSIZE(src) - SSIZE) ? (GET_BLOCKSIZE(src) - SSIZE) : (GET_BLOCKSIZE(dest) - SSIZE));
-  for(size_t i=0; i < s; i++)
-  {
-    ((char*)dest+SSIZE)[i] = ((char*)src+SSIZE)[i];
-  }
+#ifdef ALLOCATOR_USEREPORT
+    static const char *const errors[] = { "", "canary overwritten", "block isn't used", "broken node", "broken link" };
+
+    tprintf("Heap %p: %s, block %p\n", (void*)heap, errors[error], ptr);
+#else
+    (void)heap;
+    (void)ptr;
+    (void)error;
+#endif
 }
 
+#ifdef ALLOCATOR_CANARY
 /**
- * \brief Joins two adjacent blocks if they lie against each other.
+ * \brief Checks canary of block given back by the program.
  *
- * Merges two blocks toghether if nxt block is adjacent to src block
- * and both blocks have BLOCK_FREE flag set or src block is used and
- * nxt block has BLOCK_FREE flag set.
+ * Address given for zero size is payload of first block, which may
+ * be free, it's ignored as before.
  *
- * @param t_MemNode* "left" block - will become new larger block
- * @param t_MemNode* "right" block - will be merged to "left" block
- * @return t_MemNode* address of "left" block or NULL if both blocks aren't adjacent.
+ * @return int 1 if block is used and its canary is intact, 0 if error
+ * was reported
  */
-static t_MemNode *_joinBlocks(t_MemNode *src, t_MemNode *nxt)
+static int _canaryCheck(t_Heap *heap, t_MemNode *node)
 {
-  size_t newsize;
-  if ((nxt && src->next == nxt) &&
-      ((BLOCK_ISUSED(src) && BLOCK_ISFREE(nxt)) ||
-       (BLOCK_ISFREE(src) && BLOCK_ISFREE(nxt))))
-  {
-    newsize = GET_BLOCKSIZE(src) + GET_BLOCKSIZE(nxt);
-    src->next = nxt->next;
-    SET_BLOCKSIZE(src, newsize);
-  }
-  return src;
+    if (!BLOCK_ISUSED(node))
+    {
+        if (node != heap->firstblock)
+            _aheaperror(heap, (void*)OFFSET(node, SSIZE), HEAP_ERROR_FREED);
+        return 0;
+    }
+    if (node->canary == CANARY_CACHED(node))
+    {
+        _aheaperror(heap, (void*)OFFSET(node, SSIZE), HEAP_ERROR_FREED);
+        return 0;
+    }
+    if (node->canary != CANARY(node))
+    {
+        _aheaperror(heap, (void*)OFFSET(node, SSIZE), HEAP_ERROR_CANARY);
+        return 0;
+    }
+    return 1;
 }
+#endif
 
 /**
- * \brief Splits given block in two and return src address.
- *
- * src block will be splitted at given offset, src block will be
- * trimmed to "offset" size, new block will start right after src
- * and the last one will be marked as free and joined as next to the
- * src block. If offset is grater than size of src block, function
- * return src and src block will stay intact.
- *
- * @param t_MemNode* source block
- * @param size_t offset of byte where
+ * \brief Distance from node to the nearest node which payload is aligned
+ * to alignment. Non zero distance is at least MINBLOCK, so space in front
+ * of aligned node can be a free block.
  */
-static t_MemNode *_splitBlock(t_MemNode *src, size_t offset)
+size_t _alignGap(t_MemNode *node, size_t alignment)
 {
-  t_MemNode *next;
-  size_t size1, size2;
+  size_t gap = ALIGN_UP(OFFSET(node, SSIZE), alignment) - OFFSET(node, SSIZE);
 
-  if(src && offset > 0)
-  {
-      size1 = offset;
-      if (size1 % ALLOCATOR_ALIGNMENT)
-          size1 = size1 + ALLOCATOR_ALIGNMENT - (size1 % ALLOCATOR_ALIGNMENT);
-      size2 = GET_BLOCKSIZE(src) - size1;
-
-      if (size2 > SSIZE)
-      {
-          SET_BLOCKUSED(src, size1);
-          next = (t_MemNode*)OFFSET(src, size1);
-          SET_BLOCKFREE(next, size2);
-          next->next = src->next;
-          src->next = next;
-      }
-  }
-  return src;
+  while (gap && gap < MINBLOCK)
+    gap += alignment;
+  return gap;
 }
 
 /**
- * \brief _tieAdjacent - consolidates adjacent free memory blocks.
- *
- * Prevents excessive memory fragmentation when malloc and free are heavily called
- * especially with huge amount of small memory blocks are massively freed.
- * Called before each allocation and after each deallocation.
- * This function is static.
- *
- * @param t_MemNode address of block which is starting point in search of free adjacent memory blocks
+ * \brief Copies memory block using copy kernel of memops.c.
+ * Can be reimplementend in user library, e.g. to use DMA.
  */
-static void _tieAdjacent(t_MemNode *start, t_MemNode *node)
+void __attribute__((weak)) _acopymem(t_MemNode *dest, t_MemNode *src)
 {
-  start = (start ? start : firstblock);
-  t_MemNode *ntmp = start;
-  guard(start);
-
+  size_t s = ((GET_BLOCKSIZE(dest) - SSIZE) > (GET_BLOCKSIZE(src) - SSIZE) ? (GET_BLOCKSIZE(src) - SSIZE) : (GET_BLOCKSIZE(dest) - SSIZE));
+  _amemcopy((void*)OFFSET(dest, SSIZE), (void*)OFFSET(src, SSIZE), s);
+}
 
-  while(start && start != node)
-  {
+/**
+ * \brief Zeroes payload of memory block using fill kernel of memops.c.
+ * Can be reimplementend in user library, e.g. to use DMA.
+ */
+void __attribute__((weak)) _azeromem(t_MemNode *node)
+{
+  _amemfill((void*)OFFSET(node, SSIZE), 0, GET_BLOCKSIZE(node) - SSIZE);
+}
 
-      ntmp = start->next;
-      guard(ntmp);
+/**
+ * \brief Returns default heap, made of _a_heapstart and _a_heapsize.
+ */
+static t_Heap *_defaultHeap(void)
+{
+    uintptr_t pad;
 
-      if (BLOCK_ISFREE(start))
-	 start = _joinBlocks(start, ntmp);
+    if (defaultheap.start == NULL)
+    {
+        pad = ALIGN_UP(_a_heapstart, ALLOCATOR_ALIGNMENT) - (uintptr_t)_a_heapstart;
+        defaultheap.start = (uint8_t*)OFFSET(_a_heapstart, pad);
+        defaultheap.size = (_a_heapsize > pad ? _a_heapsize - pad : 0);
+        if (defaultheap.size > NODE_MAXSIZE)
+            defaultheap.size = NODE_MAXSIZE;
+    }
+    return &defaultheap;
+}
 
-      start = start->next;
-  }
+/**
+ * \brief Builds engine blocks on first use of the heap.
+ */
+static void _heapStart(t_Heap *heap)
+{
+    if (heap->firstblock == NULL)
+    {
+        HEAP_LOCK(heap);
+        if (heap->firstblock == NULL)
+        {
+            heap->firstblock = _engineInit(heap);
+            STAT_INIT(heap);
+        }
+        HEAP_UNLOCK(heap);
+    }
 }
 
 /**
- * \brief Tries to find smallest free memory block.
+ * \brief Makes independent heap in given buffer.
  *
- * Function traverses list of memory blocks and tries to
- * find memory block size in which requested by size block of memory can fit.
- * This function is static.
+ * Heap state is kept at the start of the buffer, rest of it is given
+ * to the engine. Returned handle is used with _ahmalloc(), _ahfree()
+ * and _ahrealloc().
  *
- * @param size_t requested size
- * @return t_MemNode address of found memory block or NULL
+ * @param void* buffer for the heap
+ * @param size_t size of the buffer
+ * @return t_Heap* heap handle or NULL if buffer is too small
  */
-t_MemNode *_findSmallestFit(size_t size)
+t_Heap *_aheapinit(void *buf, size_t size)
 {
-    uint32_t foundsize = _a_heapsize + 1;
-    t_MemNode *node = firstblock, *found = NULL;
+    t_Heap *heap = (t_Heap*) ALIGN_UP(buf, ALLOCATOR_ALIGNMENT);
+    size_t hsize = sizeof(t_Heap), pad = (uintptr_t)heap - (uintptr_t)buf;
 
-    if (size > _a_heapsize)
-        return found;
+    hsize = ALIGN(hsize);
+    if (!buf || size < pad + hsize + MINBLOCK)
+        return NULL;
+    size -= pad;
 
-    while(node)
+    heap->start = (uint8_t*)OFFSET(heap, hsize);
+    heap->size = size - hsize;
+    heap->policy = HEAP_FIT_BEST;
+    if (heap->size > NODE_MAXSIZE)
+        heap->size = NODE_MAXSIZE;
+#ifdef ALLOCATOR_SLAB
+    heap->slab = NULL;
+    heap->noslab = 0;
+#endif
+#ifdef ALLOCATOR_THREADSAFE
+    pthread_mutex_init(&heap->lock, NULL);
+#endif
+#ifdef ALLOCATOR_POOLS
+    heap->base = heap;
+    heap->pool = NULL;
+#endif
+#ifdef ALLOCATOR_PERSIST
+    heap->persist = NULL;
+#endif
+#ifdef ALLOCATOR_HANDLES
+    heap->handles = NULL;
+    heap->freehandle = NULL;
+#endif
+    heap->firstblock = _engineInit(heap);
+#ifdef ALLOCATOR_REMOTE_FREE
+    heap->remote.owner = NULL;
+    heap->remote.head = NULL;
+    heap->remote.zero = (uintptr_t*)OFFSET(heap->firstblock, SSIZE);
+#endif
+    STAT_INIT(heap);
+    return heap;
+}
+
+#ifdef ALLOCATOR_REMOTE_FREE
+/**
+ * \brief Returns blocks freed by other threads to the engine, under one lock.
+ *
+ * @param t_Heap* heap
+ * @param int take blocks even if calling thread isn't owner of the heap
+ * @return int number of blocks returned
+ */
+static int _heapDrain(t_Heap *heap, int any)
+{
+    uintptr_t *mem = _remoteTake(heap, any), *next;
+    t_MemNode *node;
+    size_t size;
+    int count = 0;
+
+    if (!mem)
+        return 0;
+
+    HEAP_LOCK(heap);
+    for (; mem; mem = next, count++)
     {
-        if (BLOCK_ISFREE(node) && GET_BLOCKSIZE(node) < foundsize && size <= GET_BLOCKSIZE(node))
+        next = REMOTE_NEXT(mem);
+#ifdef ALLOCATOR_SLAB
+        if (_slabSize(heap, mem))
         {
-	  found = node;
-          foundsize = GET_BLOCKSIZE(node);
+            size = _slabFree(heap, mem);
+            if (size)
+                STAT_USE(heap, -(intptr_t)size, -1);
+            continue;
         }
-        node = node->next;
+#endif
+        node = (t_MemNode*) OFFSET(mem, -SSIZE);
+        if (!CANARY_OK(heap, node) || !BLOCK_ISUSED(node))
+            continue;
+        size = GET_BLOCKSIZE(node);
+        STAT_USE(heap, -(intptr_t)(size - SSIZE), -1);
+        guard(heap, node);
+        _engineFree(heap, node);
+        STAT_ENGINE(heap, -(intptr_t)size);
     }
-    guard(node);
-    return found;
+    HEAP_UNLOCK(heap);
+    return count;
 }
+#endif
 
 /**
  * \brief Memory allocation function.
@@ -225,47 +349,77 @@ t_MemNode *_findSmallestFit(size_t size)
  * previously initialized. In that case returned address
  * shouldn't  be used as address of allocated block, although can
  * be used as _afree() argument.
+ * @param t_Heap* heap to allocate from
  * @param size_t size of memory block needed
  * @return void* address of memory block requested
  */
-void *_amalloc(size_t size)
+static void *_heapMalloc(t_Heap *heap, size_t size)
 {
-    int32_t sizediff;
-    t_MemNode *node, *nodenext;
+    t_MemNode *node;
+#ifdef ALLOCATOR_SLAB
+    void *ptr;
+#endif
 
-    if (size > _a_heapsize)
+    if (size > heap->size)
         return NULL;
 
-    if (firstblock == NULL)
+    _heapStart(heap);
+
+    if(size == 0)
+        return (void*)OFFSET(heap->firstblock, SSIZE);
+
+#ifdef ALLOCATOR_REMOTE_FREE
+    _heapDrain(heap, 0);
+#endif
+
+#ifdef ALLOCATOR_SLAB
+    //small blocks are slots of slab pages
+    if (_slabServes(heap, size))
     {
-        firstblock = (t_MemNode*) _a_heapstart;
-        firstblock->next = NULL;
-        SET_BLOCKFREE(firstblock, _a_heapsize);
-        guard(firstblock);
+        HEAP_LOCK(heap);
+        ptr = _slabAlloc(heap, size);
+        HEAP_UNLOCK(heap);
+        if (ptr)
+        {
+            STAT_USE(heap, _slabSize(heap, ptr), 1);
+            return ptr;
+        }
     }
+#endif
 
-
-    if(size == 0)
-        return (void*)OFFSET(firstblock, SSIZE);
+#ifdef ALLOCATOR_THREADSAFE
+    //blocks of default heap come from thread cache without taking heap lock
+    if (heap == &defaultheap)
+    {
+        node = _tcacheAlloc(heap, size);
+        if (node)
+        {
+            STAT_USE(heap, GET_BLOCKSIZE(node) - SSIZE, 1);
+            return (void*)OFFSET(node, SSIZE);
+        }
+    }
+#endif
 
     size += SSIZE;
     size = ALIGN(size);
 
-    node = _findSmallestFit(size);
-    if (!node)
+    HEAP_LOCK(heap);
+    node = _engineAlloc(heap, size);
+    STAT_ENGINE(heap, (node ? GET_BLOCKSIZE(node) : 0));
+    HEAP_UNLOCK(heap);
+
+    if (node)
     {
-        _tieAdjacent(firstblock, NULL);
-        node = _findSmallestFit(size);
+        CANARY_SET(node);
+        STAT_USE(heap, GET_BLOCKSIZE(node) - SSIZE, 1);
+        return (void*)OFFSET(node, SSIZE);
     }
-    guard(node);
 
-     if (node)
-     {
-        MARK_BLOCKUSED(node);
-        node = _splitBlock(node, size);
-        guard(node);
-        return (void*)OFFSET(node, SSIZE);
-     }
+#ifdef ALLOCATOR_REMOTE_FREE
+    //heap is full, blocks freed by other threads may still wait for owner
+    if (_heapDrain(heap, 1))
+        return _heapMalloc(heap, size - SSIZE);
+#endif
 
     return NULL;
 }
@@ -280,21 +434,50 @@ void *_amalloc(size_t size)
  * almost certain list of blocks will end corrupted or programm will make call to random memory
  * address wich will cause hard fault or other unpredictable consequences.
  *
+ * @param t_Heap* heap memory was allocated from
  * @param void* memory bloc to be freed
  */
-void _afree(uintptr_t *mem)
+static void _heapFree(t_Heap *heap, uintptr_t *mem)
 {
     if (!mem) return;
 
     t_MemNode *node = (t_MemNode*) OFFSET(mem, -SSIZE);
+    size_t size;
 
-    if (node && BLOCK_ISUSED(node))
+#ifdef ALLOCATOR_REMOTE_FREE
+    if (_remoteFree(heap, mem))
+        return;
+#endif
+
+#ifdef ALLOCATOR_SLAB
+    //slot is told apart by address, lock is taken only to free it
+    if (_slabSize(heap, mem))
     {
-        guard(node);
-        MARK_BLOCKFREE(node);
-        _tieAdjacent(firstblock, NULL);
+        HEAP_LOCK(heap);
+        size = _slabFree(heap, mem);
+        HEAP_UNLOCK(heap);
+        if (size)
+            STAT_USE(heap, -(intptr_t)size, -1);
+        return;
     }
+#endif
 
+    //block which isn't used was freed already
+    if (!CANARY_OK(heap, node) || !BLOCK_ISUSED(node))
+        return;
+    size = GET_BLOCKSIZE(node);
+    STAT_USE(heap, -(intptr_t)(size - SSIZE), -1);
+
+#ifdef ALLOCATOR_THREADSAFE
+    if (heap == &defaultheap && _tcacheFree(heap, node))
+        return;
+#endif
+
+    HEAP_LOCK(heap);
+    guard(heap, node);
+    _engineFree(heap, node);
+    STAT_ENGINE(heap, -(intptr_t)size);
+    HEAP_UNLOCK(heap);
 }
 
 /**
@@ -303,131 +486,1120 @@ void _afree(uintptr_t *mem)
  * Allocate memory of given size. If block at ptr is adjacent to the
  * free block, tries to merge current block to adjacent, to make larger
  * block as continuous as possible (rest of the block, if any, is marked as free).
+ * Following free block is tried first, then, if engine knows previous block,
+ * free block before ptr, in that case data is moved down and the returned
+ * address is lower than ptr.
  * If there is no such free adjacent block, function reallocates ptr at new address
  * and makes copy of ptr data at new address. If ptr == NULL function acts like _amalloc(...) and
  * return address of new memory block or NULL.
  * If size == 0 and ptr is not NULL, function work like _afree(...) and return NULL.
  * If size > 0 and ptr is not NULL, function will return same address as given in ptr or
- * new address or NULL when there is no free space for new memory block, in that case
- * memory block from ptr is not freed nor relocated.
+ * new address or NULL when there is no free space for new memory block or size is larger
+ * than the heap, in that case memory block from ptr is not freed nor relocated.
  * If both size and ptr are 0/NULL function acts like _amalloc(0) which gives ptr to memory
  * block which can be given as argument to _afree(...) function or NULL.
  *
  */
-void *_arealloc(uintptr_t *ptr, size_t size)
+static void *_heapRealloc(t_Heap *heap, uintptr_t *ptr, size_t size)
 {
   t_MemNode *node = (t_MemNode*) OFFSET(ptr, -SSIZE), *nextnode;
+  intptr_t oldsize;
 
-  guard(node);
+  if (ptr == NULL)
+    return _heapMalloc(heap, size);
 
-  if (size == 0 && ptr)
+  if (size == 0)
   {
-    _afree(ptr);
+    _heapFree(heap, ptr);
     return NULL;
   }
 
-  if (ptr == NULL && size == 0)
-    return _amalloc(0);
+  //size with node would wrap around and look like shrinking
+  if (size > heap->size)
+    return NULL;
 
+#ifdef ALLOCATOR_SLAB
+  size_t slotsize;
+  void *newptr;
 
-  if (ptr == NULL)
-    return _amalloc(size);
+  slotsize = _slabSize(heap, ptr);
+  if (slotsize)
+  {
+    if (size <= slotsize)
+      return ptr;
+
+    newptr = _heapMalloc(heap, size);
+    if (newptr)
+    {
+      _amemcopy(newptr, ptr, slotsize);
+      _heapFree(heap, ptr);
+    }
+    return newptr;
+  }
+#endif
+
+  if (!CANARY_OK(heap, node))
+    return NULL;
 
-  nextnode = node;
   size += SSIZE;
   size = ALIGN(size);
 
-
-  if (GET_BLOCKSIZE(node) >= size)
+  HEAP_LOCK(heap);
+  guard(heap, node);
+  oldsize = GET_BLOCKSIZE(node);
+  nextnode = _engineResize(heap, node, size);
+  if (nextnode)
   {
-      node = _splitBlock(node, size);
-      return (void*) OFFSET(node, SSIZE);
+    CANARY_SET(nextnode);
+    STAT_ENGINE(heap, GET_BLOCKSIZE(nextnode) - oldsize);
+    HEAP_UNLOCK(heap);
+    STAT_USE(heap, GET_BLOCKSIZE(nextnode) - oldsize, 0);
+    return (void*)OFFSET(nextnode, SSIZE);
   }
-
   //otherwise try to find new block to fit
-  nextnode = (t_MemNode*)_amalloc(size);
+  nextnode = _engineAlloc(heap, size);
+  STAT_ENGINE(heap, (nextnode ? GET_BLOCKSIZE(nextnode) : 0));
+  HEAP_UNLOCK(heap);
+
   if (nextnode)
   {
-    nextnode = (t_MemNode*)OFFSET(nextnode, -SSIZE);
-
-    guard(nextnode);
+    CANARY_SET(nextnode);
+    STAT_USE(heap, GET_BLOCKSIZE(nextnode) - SSIZE, 1);
+    guard(heap, nextnode);
     _acopymem(nextnode, node);
 
-    _afree((uintptr_t*)OFFSET(node, SSIZE));
-    MARK_BLOCKUSED(nextnode);
+    _heapFree(heap, ptr);
   }
 
   return (nextnode ? (void*)OFFSET(nextnode, SSIZE) : NULL);
 }
 
 /**
- * \brief Prints current memory usage and statistics.
+ * \brief Allocates zeroed array of nmemb elements.
+ *
+ * Block taken from engine is cleared with _azeromem(), so whole
+ * payload is zeroed, slab slot is cleared with fill kernel. Mapped
+ * block isn't cleared, it's zeroed already.
+ *
+ * @return void* address of memory or NULL if nmemb * size overflows
+ * or there is no memory available
  */
-#ifdef ALLOCATOR_USEREPORT
-void _printAllocs(uintptr_t *ptr)
+void *_ahcalloc(t_Heap *heap, size_t nmemb, size_t size)
 {
-    t_MemNode *node = firstblock, *cmp = NULL;
-    uint16_t cnt = 0, freecnt = 0, alloccnt = 0;
-    uint32_t rawfree = 0, rawalloc = 0, freesize = 0, allocsize = 0, totsize = 0, rawtot = 0;
+  void *ptr;
+  int mapped;
 
-    if (ptr)
-        cmp = (t_MemNode*) OFFSET(ptr, -SSIZE);
+  if (size && nmemb > SIZE_MAX / size)
+  {
+    STAT_OP(heap, mallocs, 0);
+    return NULL;
+  }
 
-    while(node)
+  size *= nmemb;
+  ptr = MAP_ALLOC(heap, ALLOCATOR_ALIGNMENT, size);
+  mapped = (ptr != NULL);
+  if (!ptr)
+    ptr = _heapMalloc(heap, size);
+#ifdef ALLOCATOR_POOLS
+  if (!ptr && size)
+    ptr = _poolAlloc(heap, heap, ALLOCATOR_ALIGNMENT, size);
+#endif
+  STAT_OP(heap, mallocs, (ptr || !size));
+  TRACE(TRACE_MALLOC, ptr, 0, size);
+  //new mapping is zeroed by the system
+  if (!ptr || size == 0 || mapped)
+    return ptr;
+
+#ifdef ALLOCATOR_SLAB
+  size_t slotsize;
+
+  heap = POOL_OF(heap, ptr);
+  slotsize = _slabSize(heap, ptr);
+  if (slotsize)
+  {
+    _amemfill(ptr, 0, slotsize);
+    return ptr;
+  }
+#endif
+
+  _azeromem((t_MemNode*)OFFSET(ptr, -SSIZE));
+  return ptr;
+}
+
+/**
+ * \brief Allocates memory which address is multiple of alignment.
+ *
+ * Alignments up to ALLOCATOR_ALIGNMENT are served by _ahmalloc(). For
+ * larger ones engine carves aligned block out of a free block and gives
+ * space in front of it back to free blocks, so only node is spent on
+ * alignment. Block is freed and reallocated like any other.
+ *
+ * @param size_t alignment, power of two
+ * @param size_t size of requested memory
+ * @return void* aligned address or NULL if alignment isn't power of two
+ * or there is no memory available
+ */
+static void *_heapMemalign(t_Heap *heap, size_t alignment, size_t size)
+{
+  t_MemNode *node;
+
+  if (alignment == 0 || (alignment & (alignment - 1)))
+    return NULL;
+
+  if (alignment <= ALLOCATOR_ALIGNMENT)
+    return _heapMalloc(heap, size);
+
+  if (size > heap->size || alignment > heap->size)
+    return NULL;
+
+  _heapStart(heap);
+
+#ifdef ALLOCATOR_REMOTE_FREE
+  _heapDrain(heap, 0);
+#endif
+
+  size += SSIZE;
+  size = ALIGN(size);
+
+  HEAP_LOCK(heap);
+  node = _engineAllocAligned(heap, size, alignment);
+  STAT_ENGINE(heap, (node ? GET_BLOCKSIZE(node) : 0));
+  HEAP_UNLOCK(heap);
+
+#ifdef ALLOCATOR_REMOTE_FREE
+  if (!node && _heapDrain(heap, 1))
+    return _heapMemalign(heap, alignment, size - SSIZE);
+#endif
+
+  if (!node)
+    return NULL;
+
+  CANARY_SET(node);
+  STAT_USE(heap, GET_BLOCKSIZE(node) - SSIZE, 1);
+  return (void*)OFFSET(node, SSIZE);
+}
+
+/**
+ * \brief Allocates up to count blocks of size bytes under one lock.
+ *
+ * Engine takes BATCH_NODES blocks at a time, list engine cuts them out of
+ * one free block found by single walk. Blocks which would be mapped
+ * aren't taken here.
+ *
+ * @param void** where addresses of blocks are stored
+ * @return size_t number of blocks allocated
+ */
+static size_t _heapMallocBatch(t_Heap *heap, size_t size, size_t count, void **out)
+{
+    t_MemNode *nodes[BATCH_NODES];
+    size_t done = 0, used = 0, part, n;
+
+    if (size == 0 || size > heap->size)
+        return 0;
+#ifdef ALLOCATOR_MMAP
+    if (size >= ALLOCATOR_MMAP_THRESHOLD)
+        return 0;
+#endif
+
+    _heapStart(heap);
+
+#ifdef ALLOCATOR_REMOTE_FREE
+    _heapDrain(heap, 0);
+#endif
+
+    size += SSIZE;
+    size = ALIGN(size);
+
+    HEAP_LOCK(heap);
+    while (done < count)
     {
-        guard(node);
-        if (cmp == node || !cmp)
-        tprintf("#%d\t'%c'\t"
-                "Address: 0x%08X %d Next: 0x%08X\t"
-                "Size: %u/%u\t"
-                "%s %s\n",
-                        cnt,
-                        ((char*) OFFSET(node, SSIZE))[0],
-                        (uintptr_t)node,
-                        (uintptr_t)node % ALLOCATOR_ALIGNMENT,
-                        (uintptr_t)node->next,
-                        (GET_BLOCKSIZE(node) - sizeof(t_MemNode)),
-                        GET_BLOCKSIZE(node),
-                        BLOCK_ISFREE(node) ? "Free" : "Used",
-                        (cmp ? (cmp == node ? "*" : "") : ""));
+        part = (count - done < BATCH_NODES ? count - done : BATCH_NODES);
+        n = _engineAllocBatch(heap, size, part, nodes);
+        for (size_t i = 0; i < n; i++)
+        {
+            CANARY_SET(nodes[i]);
+            used += GET_BLOCKSIZE(nodes[i]);
+            out[done++] = (void*)OFFSET(nodes[i], SSIZE);
+        }
+        if (n < part)
+            break;
+    }
+    STAT_ENGINE(heap, used);
+    HEAP_UNLOCK(heap);
 
-        if (BLOCK_ISFREE(node))
-	{
-            freesize += (GET_BLOCKSIZE(node) - SSIZE);
-	    rawfree += GET_BLOCKSIZE(node);
-	}
-        else
-	{
-            allocsize += (GET_BLOCKSIZE(node) - SSIZE);
-	    rawalloc += GET_BLOCKSIZE(node);
-	}
-	rawtot += GET_BLOCKSIZE(node);
-	totsize += (GET_BLOCKSIZE(node) - SSIZE);
-        cnt++;
+    STAT_USE(heap, used - done * SSIZE, (int)done);
+    return done;
+}
 
-        if (BLOCK_ISFREE(node))
-            freecnt++;
-        else
-            alloccnt++;
-        node = node->next;
+/**
+ * \brief Frees count blocks of the heap under one lock, engine
+ * consolidates them at once. Slab slots are freed one by one. Blocks
+ * are marked free while they are collected, so block listed twice is
+ * freed once, as by two calls of _afree().
+ */
+static void _heapFreeBatch(t_Heap *heap, uintptr_t **mems, size_t count)
+{
+    t_MemNode *nodes[BATCH_NODES], *node;
+    size_t n = 0, size = 0;
+
+    HEAP_LOCK(heap);
+    for (size_t i = 0; i < count; i++)
+    {
+#ifdef ALLOCATOR_SLAB
+        if (_slabSize(heap, mems[i]))
+        {
+            size_t slotsize = _slabFree(heap, mems[i]);
+
+            if (slotsize)
+                STAT_USE(heap, -(intptr_t)slotsize, -1);
+            continue;
+        }
+#endif
+        node = (t_MemNode*) OFFSET(mems[i], -SSIZE);
+        //block which isn't used was freed already, also earlier in this batch
+        if (!CANARY_OK(heap, node) || !BLOCK_ISUSED(node))
+            continue;
+        guard(heap, node);
+        size += GET_BLOCKSIZE(node);
+        STAT_USE(heap, -(intptr_t)(GET_BLOCKSIZE(node) - SSIZE), -1);
+        MARK_BLOCKFREE(node);
+        nodes[n++] = node;
     }
-    if(!cmp)
-    tprintf("\nSummary:\n\t"
-          "Memory size: %u in %d blocks\n"
-          "\t%d blocks (%u/%u) free,%d blocks (%u/%u) used.\n"
-          "\t%u bytes used for list representation\n"
-          "\tFirst block 0x%08LX\n\n",
-                                    _a_heapsize,
-                                    cnt,
-                                    freecnt,
-                                    freesize, rawfree,
-                                    alloccnt,
-                                    allocsize, rawalloc,
-                                    (rawfree + rawalloc) - (freesize + allocsize),
-                                    (uintptr_t)firstblock);
+    //engine takes only used blocks
+    for (size_t i = 0; i < n; i++)
+        MARK_BLOCKUSED(nodes[i]);
+    _engineFreeBatch(heap, nodes, n);
+    STAT_ENGINE(heap, -(intptr_t)size);
+    HEAP_UNLOCK(heap);
 }
+
+/**
+ * \brief Bytes of payload of block in the heap, slab slot or block of engine.
+ */
+static size_t _heapPayload(t_Heap *heap, uintptr_t *ptr)
+{
+    t_MemNode *node = (t_MemNode*) OFFSET(ptr, -SSIZE);
+    size_t payload = 0;
+
+#ifdef ALLOCATOR_SLAB
+    payload = _slabSize(heap, ptr);
 #else
-void __attribute__((weak)) _printAllocs(void)
+    (void)heap;
+#endif
+    return (payload ? payload : GET_BLOCKSIZE(node) - SSIZE);
+}
+
+#ifdef ALLOCATOR_POOLS
+/**
+ * \brief Default growth callback, heap doesn't grow.
+ * Can be reimplemented to give heap more memory, e.g. by mmap().
+ */
+void * __attribute__((weak)) _agrow(t_Heap *heap, size_t *size)
+{
+    (void)heap;
+    (void)size;
+    return NULL;
+}
+
+/**
+ * \brief Makes heap in buffer and appends it to pools of given heap,
+ * with placement policy of the heap. Pools are never removed, so list
+ * is walked without lock.
+ */
+static t_Heap *_poolAdd(t_Heap *heap, void *buf, size_t size)
+{
+    t_Heap *pool = _aheapinit(buf, size), *last;
+
+    if (!pool)
+        return NULL;
+
+    heap = BASEHEAP(heap);
+    pool->base = heap;
+#ifdef ALLOCATOR_REMOTE_FREE
+    pool->remote.owner = __atomic_load_n(&heap->remote.owner, __ATOMIC_RELAXED);
+#endif
+
+    HEAP_LOCK(heap);
+    _engineSetPolicy(pool, heap->policy);
+    for (last = heap; last->pool; last = last->pool)
+        ;
+    __atomic_store_n(&last->pool, pool, __ATOMIC_RELEASE);
+    HEAP_UNLOCK(heap);
+    return pool;
+}
+
+/**
+ * \brief Adds buffer as new pool of given heap.
+ *
+ * @return int 1 if pool was added, 0 if buffer is too small
+ */
+int _ahaddpool(t_Heap *heap, void *buf, size_t size)
+{
+    return (_poolAdd(heap, buf, size) != NULL);
+}
+
+/**
+ * \brief Adds buffer as new pool of default heap.
+ */
+int _aaddpool(void *buf, size_t size)
+{
+    return _ahaddpool(_defaultHeap(), buf, size);
+}
+
+/**
+ * \brief Finds pool of the heap which holds mem, heap itself if none does.
+ */
+static t_Heap *_poolOf(t_Heap *heap, void *mem)
+{
+    for (t_Heap *pool = heap; pool; pool = NEXTPOOL(pool))
+        if ((uint8_t*)mem >= pool->start && (uint8_t*)mem < pool->start + pool->size)
+            return pool;
+    return heap;
+}
+
+/**
+ * \brief Allocates from heap or any of its pools except skip, which was
+ * tried already. When all are full, adds new pool taken from _agrow().
+ *
+ * @return void* address of memory or NULL if heap can't grow
+ */
+static void *_poolAlloc(t_Heap *heap, t_Heap *skip, size_t alignment, size_t size)
+{
+    t_Heap *pool;
+    size_t growsize;
+    void *buf;
+
+    if (alignment == 0 || (alignment & (alignment - 1)))
+        return NULL;
+
+    for (pool = heap; pool; pool = NEXTPOOL(pool))
+        if (pool != skip && (buf = _heapMemalign(pool, alignment, size)))
+            return buf;
+
+    //pool state, node, alignment gap and engine rounding up to power of two
+    if (size > (SIZE_MAX - alignment) / 4)
+        return NULL;
+    growsize = 2 * (ALIGN_UP(sizeof(t_Heap), ALLOCATOR_ALIGNMENT) + SSIZE + alignment + size);
+    if (growsize < ALLOCATOR_GROW_SIZE)
+        growsize = ALLOCATOR_GROW_SIZE;
+
+    buf = _agrow(heap, &growsize);
+    pool = (buf ? _poolAdd(heap, buf, growsize) : NULL);
+    return (pool ? _heapMemalign(pool, alignment, size) : NULL);
+}
+
+/**
+ * \brief Moves block which can't grow in its own pool to any other one.
+ */
+static void *_poolMove(t_Heap *heap, t_Heap *pool, uintptr_t *ptr, size_t size)
+{
+    size_t payload = _heapPayload(pool, ptr);
+    void *newptr;
+
+    newptr = _poolAlloc(heap, pool, ALLOCATOR_ALIGNMENT, size);
+    if (newptr)
+    {
+        _amemcopy(newptr, ptr, (payload < size ? payload : size));
+        _heapFree(pool, ptr);
+    }
+    return newptr;
+}
+#endif
+
+#ifdef ALLOCATOR_MMAP
+/**
+ * \brief Tells if mem lies neither in the heap nor in any of its pools,
+ * so it was mapped by mmap.c.
+ */
+static int _isMapped(t_Heap *heap, void *mem)
+{
+    if (!mem)
+        return 0;
+
+    for (t_Heap *pool = heap; pool; pool = NEXTPOOL(pool))
+        if ((uint8_t*)mem >= pool->start && (uint8_t*)mem < pool->start + pool->size)
+            return 0;
+    return 1;
+}
+
+/**
+ * \brief Gives block of at least ALLOCATOR_MMAP_THRESHOLD bytes
+ * mapping of its own. Block is counted as used by the heap.
+ *
+ * @return void* address of memory or NULL if block is smaller or
+ * it can't be mapped, it's taken from the heap then
+ */
+static void *_mapAlloc(t_Heap *heap, size_t alignment, size_t size)
+{
+    t_MemNode *node;
+    void *ptr;
+
+    if (size < ALLOCATOR_MMAP_THRESHOLD)
+        return NULL;
+
+    ptr = _mmapAlloc(alignment, size);
+    if (!ptr)
+        return NULL;
+
+    node = (t_MemNode*) OFFSET(ptr, -SSIZE);
+    CANARY_SET(node);
+#ifndef ALLOCATOR_STATS
+    (void)heap;
+#endif
+    STAT_USE(heap, GET_BLOCKSIZE(node) - SSIZE, 1);
+    return ptr;
+}
+
+static void _mapFree(t_Heap *heap, uintptr_t *mem)
+{
+    t_MemNode *node = (t_MemNode*) OFFSET(mem, -SSIZE);
+
+#ifndef ALLOCATOR_STATS
+    (void)heap;
+#endif
+    STAT_USE(heap, -(intptr_t)(GET_BLOCKSIZE(node) - SSIZE), -1);
+    _mmapFree(mem);
+}
+
+/**
+ * \brief Realloc of mapped block, or of block growing over threshold.
+ *
+ * Block of the heap which grows over ALLOCATOR_MMAP_THRESHOLD is moved
+ * to mapping of its own, mapped block is resized by mremap(). Mapped
+ * block which shrinks below threshold goes back to the heap if there
+ * is space for it, otherwise its mapping is shrunk.
+ *
+ * @return void* address of memory or NULL, same as _heapRealloc()
+ */
+static void *_mapRealloc(t_Heap *heap, t_Heap *pool, uintptr_t *ptr, size_t size)
+{
+    t_MemNode *node = (t_MemNode*) OFFSET(ptr, -SSIZE);
+    size_t payload;
+    void *newptr;
+
+    if (!_isMapped(heap, ptr))
+    {
+        newptr = _mapAlloc(heap, ALLOCATOR_ALIGNMENT, size);
+        if (!newptr)
+            return _heapRealloc(pool, ptr, size);
+        if (ptr)
+        {
+            payload = _heapPayload(pool, ptr);
+            _amemcopy(newptr, ptr, (payload < size ? payload : size));
+            _heapFree(pool, ptr);
+        }
+        return newptr;
+    }
+
+    if (!CANARY_OK(heap, node))
+        return NULL;
+
+    if (size == 0)
+    {
+        _mapFree(heap, ptr);
+        return NULL;
+    }
+
+    payload = GET_BLOCKSIZE(node) - SSIZE;
+    if (size < ALLOCATOR_MMAP_THRESHOLD)
+    {
+        newptr = _heapMalloc(heap, size);
+        if (newptr)
+        {
+            _amemcopy(newptr, ptr, size);
+            _mapFree(heap, ptr);
+            return newptr;
+        }
+    }
+
+    newptr = _mmapResize(ptr, size);
+    if (!newptr)
+        return NULL;
+
+    node = (t_MemNode*) OFFSET(newptr, -SSIZE);
+    CANARY_SET(node);
+    STAT_USE(heap, (intptr_t)(GET_BLOCKSIZE(node) - SSIZE - payload), 0);
+    return newptr;
+}
+
+/**
+ * \brief Gives pages inside free blocks of the heap and its pools back
+ * to the system.
+ *
+ * Blocks cached by threads aren't free for the engine, so they aren't
+ * trimmed. Memory of the heap has to be mapped with mmap() or be part
+ * of program data, so it's paged by the system.
+ *
+ * @param t_Heap* heap
+ * @return size_t number of bytes released
+ */
+size_t _ahtrim(t_Heap *heap)
+{
+    size_t released = 0;
+
+    _heapStart(heap);
+    for (t_Heap *pool = heap; pool; pool = NEXTPOOL(pool))
+    {
+        HEAP_LOCK(pool);
+        released += _mmapTrim(pool);
+        HEAP_UNLOCK(pool);
+    }
+    return released;
+}
+
+/**
+ * \brief Gives pages inside free blocks of default heap back to the system.
+ */
+size_t _atrim(void)
+{
+    return _ahtrim(_defaultHeap());
+}
+#endif
+
+#ifdef ALLOCATOR_HANDLES
+/**
+ * \brief Allocates movable block from default heap.
+ */
+t_Handle _amallochandle(size_t size)
+{
+    return _ahmallochandle(_defaultHeap(), size);
+}
+
+/**
+ * \brief Compacts default heap.
+ */
+size_t _acompact(void)
+{
+    t_Heap *heap = _defaultHeap();
+
+    _heapStart(heap);
+    return _ahcompact(heap);
+}
+#endif
+
+/*
+ * Public heap functions are counted when ALLOCATOR_STATS is defined and
+ * record trace when ALLOCATOR_TRACE is defined.
+ * Internal calls between them aren't recorded. Block is recorded as
+ * freed before it's released and as allocated after it's taken, so
+ * other thread can't record the same address in between.
+ */
+void *_ahmalloc(t_Heap *heap, size_t size)
+{
+  void *ptr = MAP_ALLOC(heap, ALLOCATOR_ALIGNMENT, size);
+
+  if (!ptr)
+    ptr = _heapMalloc(heap, size);
+
+#ifdef ALLOCATOR_POOLS
+  if (!ptr && size)
+    ptr = _poolAlloc(heap, heap, ALLOCATOR_ALIGNMENT, size);
+#endif
+
+  STAT_OP(heap, mallocs, (ptr || !size));
+  TRACE(TRACE_MALLOC, ptr, 0, size);
+  return ptr;
+}
+
+void _ahfree(t_Heap *heap, uintptr_t *mem)
+{
+  STAT_OP(heap, frees, 1);
+  TRACE(TRACE_FREE, mem, 0, 0);
+#ifdef ALLOCATOR_MMAP
+  if (MAPPED(heap, mem))
+  {
+    if (CANARY_OK(heap, (t_MemNode*)OFFSET(mem, -SSIZE)))
+      _mapFree(heap, mem);
+    return;
+  }
+#endif
+  _heapFree(POOL_OF(heap, mem), mem);
+}
+
+void *_ahrealloc(t_Heap *heap, uintptr_t *ptr, size_t size)
+{
+  t_Heap *pool = POOL_OF(heap, ptr);
+  void *newptr;
+
+#ifdef ALLOCATOR_MMAP
+  if (MAPPED(heap, ptr) || size >= ALLOCATOR_MMAP_THRESHOLD)
+    newptr = _mapRealloc(heap, pool, ptr, size);
+  else
+#endif
+  newptr = _heapRealloc(pool, ptr, size);
+
+#ifdef ALLOCATOR_POOLS
+  if (!newptr && size && !MAPPED(heap, ptr))
+    newptr = (ptr ? _poolMove(heap, pool, ptr, size) : _poolAlloc(heap, heap, ALLOCATOR_ALIGNMENT, size));
+#endif
+
+  STAT_OP(heap, reallocs, (newptr || !size));
+  TRACE(TRACE_REALLOC, newptr, (uintptr_t)ptr, size);
+  return newptr;
+}
+
+void *_ahmemalign(t_Heap *heap, size_t alignment, size_t size)
+{
+  void *ptr = MAP_ALLOC(heap, alignment, size);
+
+  if (!ptr)
+    ptr = _heapMemalign(heap, alignment, size);
+
+#ifdef ALLOCATOR_POOLS
+  if (!ptr)
+    ptr = _poolAlloc(heap, heap, alignment, size);
+#endif
+
+  STAT_OP(heap, mallocs, (ptr != NULL));
+  TRACE(TRACE_MEMALIGN, ptr, alignment, size);
+  return ptr;
+}
+
+/**
+ * \brief Bytes of payload of block allocated from given heap, at least
+ * as many as were asked for, program can use all of them.
+ *
+ * @param t_Heap* heap
+ * @param void* address of memory
+ * @return size_t size of payload or 0 for NULL
+ */
+size_t _ahmalloc_usable_size(t_Heap *heap, void *ptr)
+{
+  if (!ptr)
+    return 0;
+#ifdef ALLOCATOR_MMAP
+  if (MAPPED(heap, ptr))
+  {
+    t_MemNode *node = (t_MemNode*) OFFSET(ptr, -SSIZE);
+
+    return GET_BLOCKSIZE(node) - SSIZE;
+  }
+#endif
+  return _heapPayload(POOL_OF(heap, ptr), ptr);
+}
+
+/**
+ * \brief Allocates up to count blocks of size bytes from given heap.
+ *
+ * Blocks are taken from the heap under one lock, list engine finds
+ * one free block for all of them. What heap can't give at once is
+ * allocated one by one, from mappings or pools. Every block is freed
+ * on its own or by _ahfree_batch().
+ *
+ * @param t_Heap* heap
+ * @param size_t size of every block
+ * @param size_t number of blocks
+ * @param void** array of count addresses of allocated blocks
+ * @return size_t number of blocks allocated, less than count if
+ * there is no more memory
+ */
+size_t _ahmalloc_batch(t_Heap *heap, size_t size, size_t count, void **out)
+{
+  size_t done = _heapMallocBatch(heap, size, count, out);
+
+  for (size_t i = 0; i < done; i++)
+  {
+    STAT_OP(heap, mallocs, 1);
+    TRACE(TRACE_MALLOC, out[i], 0, size);
+  }
+
+  for (; done < count; done++)
+    if (!(out[done] = _ahmalloc(heap, size)))
+      break;
+  return done;
+}
+
+/**
+ * \brief Frees count blocks of given heap.
+ *
+ * Blocks of the heap itself are returned to engine BATCH_NODES at a
+ * time under one lock, with list engine without boundary tags the list
+ * is consolidated once for all of them. Mapped blocks, blocks of pools
+ * and NULL are freed one by one.
+ *
+ * @param t_Heap* heap
+ * @param void** addresses of blocks
+ * @param size_t number of addresses
+ */
+void _ahfree_batch(t_Heap *heap, void **ptrs, size_t count)
+{
+  uintptr_t *mems[BATCH_NODES], *mem;
+  t_Heap *pool;
+  size_t n = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    mem = ptrs[i];
+    pool = POOL_OF(heap, mem);
+    if (!mem || MAPPED(heap, mem) || pool != heap)
+    {
+      _ahfree(heap, mem);
+      continue;
+    }
+
+    STAT_OP(heap, frees, 1);
+    TRACE(TRACE_FREE, mem, 0, 0);
+#ifdef ALLOCATOR_REMOTE_FREE
+    if (_remoteFree(heap, mem))
+      continue;
+#endif
+    mems[n++] = mem;
+    if (n == BATCH_NODES)
+    {
+      _heapFreeBatch(heap, mems, n);
+      n = 0;
+    }
+  }
+  if (n)
+    _heapFreeBatch(heap, mems, n);
+}
+
+/**
+ * \brief Memory allocation function, allocates from default heap.
+ */
+void *_amalloc(size_t size)
+{
+    return _ahmalloc(_defaultHeap(), size);
+}
+
+/**
+ * \brief Memory free function, frees memory of default heap.
+ */
+void _afree(uintptr_t *mem)
+{
+    _ahfree(_defaultHeap(), mem);
+}
+
+/**
+ * \brief Realloc previously allocated memory of default heap.
+ */
+void *_arealloc(uintptr_t *ptr, size_t size)
+{
+    return _ahrealloc(_defaultHeap(), ptr, size);
+}
+
+/**
+ * \brief Allocates zeroed array from default heap.
+ */
+void *_acalloc(size_t nmemb, size_t size)
+{
+    return _ahcalloc(_defaultHeap(), nmemb, size);
+}
+
+/**
+ * \brief Allocates aligned memory from default heap.
+ */
+void *_amemalign(size_t alignment, size_t size)
+{
+    return _ahmemalign(_defaultHeap(), alignment, size);
+}
+
+/**
+ * \brief Allocates aligned memory from default heap.
+ */
+void *_aaligned_alloc(size_t alignment, size_t size)
+{
+    return _ahmemalign(_defaultHeap(), alignment, size);
+}
+
+/**
+ * \brief Bytes of payload of block allocated from default heap.
+ */
+size_t _amalloc_usable_size(void *ptr)
+{
+    return _ahmalloc_usable_size(_defaultHeap(), ptr);
+}
+
+#ifdef ALLOCATOR_THREADSAFE
+/**
+ * \brief Takes locks of default heap and its pools, in order of the
+ * pool list, so fork() doesn't leave child with lock held by thread
+ * which isn't there. Given to pthread_atfork() with _aforkunlock().
+ */
+void _aforklock(void)
+{
+    for (t_Heap *pool = _defaultHeap(); pool; pool = NEXTPOOL(pool))
+        HEAP_LOCK(pool);
+}
+
+/**
+ * \brief Releases locks taken by _aforklock(), in parent and in child.
+ */
+void _aforkunlock(void)
+{
+    for (t_Heap *pool = _defaultHeap(); pool; pool = NEXTPOOL(pool))
+        HEAP_UNLOCK(pool);
+}
+#endif
+
+/**
+ * \brief Sets placement policy of the heap and all its pools, pools added
+ * later get it as well. Next fit search of persistent heap would resume
+ * at block other processes may have joined, so it's refused.
+ *
+ * @return int 1 if engine has the policy, 0 otherwise
+ */
+int _ahsetpolicy(t_Heap *heap, t_HeapPolicy policy)
+{
+    int done = 1;
+
+    if ((unsigned)policy > HEAP_FIT_ADDRESS)
+        return 0;
+#ifdef ALLOCATOR_PERSIST
+    if (heap->persist && policy == HEAP_FIT_NEXT)
+        return 0;
+#endif
+
+    _heapStart(heap);
+    for (t_Heap *pool = heap; pool && done; pool = NEXTPOOL(pool))
+    {
+        HEAP_LOCK(pool);
+        done = _engineSetPolicy(pool, policy);
+        HEAP_UNLOCK(pool);
+    }
+    return done;
+}
+
+/**
+ * \brief Sets placement policy of default heap.
+ */
+int _asetpolicy(t_HeapPolicy policy)
+{
+    return _ahsetpolicy(_defaultHeap(), policy);
+}
+
+/**
+ * \brief Checks every block of the heap, heap lock has to be taken.
+ *
+ * Block has to lie in the heap, be aligned, larger than node and
+ * followed right by the next one. Walk stops at first broken node,
+ * blocks behind it can't be found. With boundary tags and TLSF link to
+ * previous block is checked, with ALLOCATOR_CANARY canary of every used block.
+ *
+ * @return size_t number of errors reported
+ */
+static size_t _heapValidate(t_Heap *heap, t_HeapReport report)
+{
+    uint8_t *end = heap->start + heap->size;
+    t_MemNode *node, *next;
+    size_t errors = 0;
+
+    for (node = heap->firstblock; node; node = next)
+    {
+        if ((uint8_t*)node < heap->start || (uint8_t*)node + SSIZE > end ||
+            (uintptr_t)node % ALLOCATOR_ALIGNMENT || GET_BLOCKSIZE(node) < SSIZE ||
+            GET_BLOCKSIZE(node) > (size_t)(end - (uint8_t*)node))
+        {
+            report(heap, (void*)OFFSET(node, SSIZE), HEAP_ERROR_NODE);
+            return errors + 1;
+        }
+
+        next = GET_NEXT(node);
+        if (next && next != (t_MemNode*)OFFSET(node, GET_BLOCKSIZE(node)))
+        {
+            report(heap, (void*)OFFSET(node, SSIZE), HEAP_ERROR_NODE);
+            return errors + 1;
+        }
+#if defined(ALLOCATOR_ENGINE_TLSF) || defined(ALLOCATOR_BOUNDARY_TAGS)
+        if (next && GET_PREV(next) != node)
+        {
+            report(heap, (void*)OFFSET(next, SSIZE), HEAP_ERROR_LINK);
+            errors++;
+        }
+#endif
+#ifdef ALLOCATOR_CANARY
+        if (BLOCK_ISUSED(node) && node->canary != CANARY(node) && node->canary != CANARY_CACHED(node))
+        {
+            report(heap, (void*)OFFSET(node, SSIZE), HEAP_ERROR_CANARY);
+            errors++;
+        }
+#endif
+    }
+    return errors;
+}
+
+/**
+ * \brief Checks every block of given heap and its pools.
+ *
+ * Meant to be called from watchdog or test, it walks whole heap under
+ * its lock. Errors are reported to callback, which must not use the
+ * heap, mapped blocks are checked only when they are freed.
+ *
+ * @param t_Heap* heap
+ * @param t_HeapReport callback called for every error, NULL for _aheaperror()
+ * @return size_t number of errors found, 0 if heap is intact
+ */
+size_t _ahvalidate(t_Heap *heap, t_HeapReport report)
+{
+    size_t errors = 0;
+
+    if (!report)
+        report = _aheaperror;
+
+    _heapStart(heap);
+    for (t_Heap *pool = heap; pool; pool = NEXTPOOL(pool))
+    {
+        HEAP_LOCK(pool);
+        errors += _heapValidate(pool, report);
+        HEAP_UNLOCK(pool);
+    }
+    return errors;
+}
+
+/**
+ * \brief Checks every block of default heap.
+ */
+size_t _avalidate(t_HeapReport report)
+{
+    return _ahvalidate(_defaultHeap(), report);
+}
+
+/**
+ * \brief Allocates up to count blocks of size bytes from default heap.
+ */
+size_t _amalloc_batch(size_t size, size_t count, void **out)
+{
+    return _ahmalloc_batch(_defaultHeap(), size, count, out);
+}
+
+/**
+ * \brief Frees count blocks of default heap.
+ */
+void _afree_batch(void **ptrs, size_t count)
+{
+    _ahfree_batch(_defaultHeap(), ptrs, count);
+}
+
+#ifdef ALLOCATOR_STATS
+/**
+ * \brief Copies counters of given heap.
+ *
+ * Counters are updated by every operation, so copy takes the same time
+ * regardless of number of blocks. Heap lock isn't taken, so heap can be
+ * polled from other thread without pausing allocation. Every counter
+ * is read atomically.
+ *
+ * @param t_Heap* heap
+ * @param t_HeapStats* where counters are copied to
+ */
+void _ahgetstats(t_Heap *heap, t_HeapStats *stats)
+{
+    t_HeapStats *src = &heap->stats;
+
+    _heapStart(heap);
+
+    stats->size = __atomic_load_n(&src->size, __ATOMIC_RELAXED);
+    stats->used = __atomic_load_n(&src->used, __ATOMIC_RELAXED);
+    stats->usedblocks = __atomic_load_n(&src->usedblocks, __ATOMIC_RELAXED);
+    stats->free = __atomic_load_n(&src->free, __ATOMIC_RELAXED);
+    stats->largest = __atomic_load_n(&src->largest, __ATOMIC_RELAXED);
+    stats->peak = __atomic_load_n(&src->peak, __ATOMIC_RELAXED);
+    stats->mallocs = __atomic_load_n(&src->mallocs, __ATOMIC_RELAXED);
+    stats->frees = __atomic_load_n(&src->frees, __ATOMIC_RELAXED);
+    stats->reallocs = __atomic_load_n(&src->reallocs, __ATOMIC_RELAXED);
+    stats->failed = __atomic_load_n(&src->failed, __ATOMIC_RELAXED);
+
+#ifdef ALLOCATOR_POOLS
+    for (heap = NEXTPOOL(heap); heap; heap = NEXTPOOL(heap))
+    {
+        src = &heap->stats;
+        stats->size += __atomic_load_n(&src->size, __ATOMIC_RELAXED);
+        stats->free += __atomic_load_n(&src->free, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&src->largest, __ATOMIC_RELAXED) > stats->largest)
+            stats->largest = __atomic_load_n(&src->largest, __ATOMIC_RELAXED);
+    }
+#endif
+}
+
+/**
+ * \brief Copies counters of default heap.
+ */
+void _agetstats(t_HeapStats *stats)
+{
+    _ahgetstats(_defaultHeap(), stats);
+}
+#endif
+
+/**
+ * \brief Prints current memory usage and statistics.
+ */
+#ifdef ALLOCATOR_USEREPORT
+void _printHeapAllocs(t_Heap *heap, uintptr_t *ptr)
+{
+    t_MemNode *node = heap->firstblock, *cmp = NULL;
+    size_t cnt = 0, freecnt = 0, alloccnt = 0;
+    size_t rawfree = 0, rawalloc = 0, freesize = 0, allocsize = 0;
+
+    if (ptr)
+        cmp = (t_MemNode*) OFFSET(ptr, -SSIZE);
+
+    while(node)
+    {
+        guard(heap, node);
+        if (cmp == node || !cmp)
+        tprintf("#%zu\t'%c'\t"
+                "Address: %p %u Next: %p\t"
+                "Size: %zu/%zu\t"
+                "%s %s\n",
+                        cnt,
+                        ((char*) OFFSET(node, SSIZE))[0],
+                        (void*)node,
+                        (unsigned int)((uintptr_t)node % ALLOCATOR_ALIGNMENT),
+                        (void*)GET_NEXT(node),
+                        (GET_BLOCKSIZE(node) - SSIZE),
+                        GET_BLOCKSIZE(node),
+                        BLOCK_ISFREE(node) ? "Free" : "Used",
+                        (cmp ? (cmp == node ? "*" : "") : ""));
+
+        if (BLOCK_ISFREE(node))
+	{
+            freesize += (GET_BLOCKSIZE(node) - SSIZE);
+	    rawfree += GET_BLOCKSIZE(node);
+	}
+        else
+	{
+            allocsize += (GET_BLOCKSIZE(node) - SSIZE);
+	    rawalloc += GET_BLOCKSIZE(node);
+	}
+        cnt++;
+
+        if (BLOCK_ISFREE(node))
+            freecnt++;
+        else
+            alloccnt++;
+        node = GET_NEXT(node);
+    }
+    if(!cmp)
+    tprintf("\nSummary:\n\t"
+          "Memory size: %zu in %zu blocks\n"
+          "\t%zu blocks (%zu/%zu) free,%zu blocks (%zu/%zu) used.\n"
+          "\t%zu bytes used for list representation\n"
+          "\tFirst block %p\n\n",
+                                    heap->size,
+                                    cnt,
+                                    freecnt,
+                                    freesize, rawfree,
+                                    alloccnt,
+                                    allocsize, rawalloc,
+                                    (rawfree + rawalloc) - (freesize + allocsize),
+                                    (void*)heap->firstblock);
+#ifdef ALLOCATOR_POOLS
+    if (heap->pool)
+        _printHeapAllocs(heap->pool, ptr);
+#endif
+}
+
+void _printAllocs(uintptr_t *ptr)
+{
+    _printHeapAllocs(_defaultHeap(), ptr);
+}
+#else
+void __attribute__((weak)) _printAllocs(uintptr_t *ptr)
+{
+  //Stub function
+}
+
+void __attribute__((weak)) _printHeapAllocs(t_Heap *heap, uintptr_t *ptr)
 {
   //Stub function
 }
@@ -0,0 +1,362 @@
+/*
+ * buddy.c
+ * Binary buddy engine.
+ * Heap is divided in blocks which sizes are powers of two, every block
+ * of order k lies at offset divisible by 2^k from the start of the
+ * buddy region, so its buddy is found by simple XOR of the offset.
+ * For every order there is bitmap, bit is set when free block of that
+ * order starts at given offset, and list of such blocks. Bitmaps are
+ * placed at the start of the heap, blocks follow them.
+ * Merging of freed block with its buddies and splitting of larger
+ * block is done without walking the heap.
+ * Start of the buddy region is placed so that payload of its first block
+ * is aligned to ALLOCATOR_BUDDY_ALIGN (less on small heap), then payload
+ * of every block of order k is aligned to 2^k (up to that alignment) and
+ * aligned allocation is just allocation of large enough order.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+#include <allocator_lib.h>
+#include <limits.h>
+#include <assert.h>
+
+#ifdef ALLOCATOR_USEREPORT
+#include <stdio.h>
+#endif
+
+#define ORDERSIZE(ORDER) ((size_t)1 << (ORDER))
+
+/*! \def BUDDY_ALIGN
+ * \brief Alignment of payload engine gives on any heap.
+ */
+#define BUDDY_ALIGN (ALLOCATOR_ALIGNMENT > 64 ? ALLOCATOR_ALIGNMENT : 64)
+
+#if ALLOCATOR_BUDDY_ALIGN & (ALLOCATOR_BUDDY_ALIGN - 1)
+#error "ALLOCATOR_BUDDY_ALIGN has to be power of two"
+#endif
+
+#define MAPWORD(MAP, BIT) ((MAP)[(BIT) / 32])
+#define MAPMASK(BIT) (1U << ((BIT) % 32))
+
+/**
+ * \brief Index of most significant bit set, v must not be 0.
+ */
+static inline int _fls(size_t v)
+{
+    return (int)(sizeof(unsigned long long) * CHAR_BIT) - 1 - __builtin_clzll(v);
+}
+
+/**
+ * \brief Smallest order which block can hold size bytes.
+ */
+static int _sizeOrder(t_Engine *e, size_t size)
+{
+    int order = _fls(size);
+
+    if (size & (ORDERSIZE(order) - 1))
+        order++;
+    return (order < e->minorder ? e->minorder : order);
+}
+
+/**
+ * \brief Index of block in bitmap of given order.
+ */
+static inline size_t _mapBit(t_Engine *e, t_MemNode *node, int order)
+{
+    return ((uintptr_t)node - (uintptr_t)e->base) >> order;
+}
+
+/**
+ * \brief Checks whether block at offset is free block of given order.
+ */
+static inline int _isFree(t_Engine *e, size_t offset, int order)
+{
+    return (MAPWORD(e->freemaps[order], offset >> order) & MAPMASK(offset >> order)) != 0;
+}
+
+/**
+ * \brief Marks block as free block of given order and puts it on its list.
+ */
+static void _insertFree(t_Engine *e, t_MemNode *node, int order)
+{
+    t_FreeLinks *links = FREELINKS(node);
+    size_t bit = _mapBit(e, node, order);
+
+    SET_BLOCKFREE(node, ORDERSIZE(order));
+    MAPWORD(e->freemaps[order], bit) |= MAPMASK(bit);
+
+    links->prevfree = NULL;
+    links->nextfree = e->freelists[order];
+    if (links->nextfree)
+        FREELINKS(links->nextfree)->prevfree = node;
+    e->freelists[order] = node;
+    e->ordermap |= (uint64_t)1 << order;
+}
+
+/**
+ * \brief Unlinks free block of given order from its list.
+ */
+static void _removeFree(t_Engine *e, t_MemNode *node, int order)
+{
+    t_FreeLinks *links = FREELINKS(node);
+    size_t bit = _mapBit(e, node, order);
+
+    MAPWORD(e->freemaps[order], bit) &= ~MAPMASK(bit);
+
+    if (links->nextfree)
+        FREELINKS(links->nextfree)->prevfree = links->prevfree;
+    if (links->prevfree)
+        FREELINKS(links->prevfree)->nextfree = links->nextfree;
+    else
+        e->freelists[order] = links->nextfree;
+
+    if (!e->freelists[order])
+        e->ordermap &= ~((uint64_t)1 << order);
+}
+
+/**
+ * \brief Splits block down to given order, upper halves become free blocks.
+ */
+static void _splitBlock(t_Engine *e, t_MemNode *node, int order, int target)
+{
+    t_MemNode *half;
+
+    while (order > target)
+    {
+        order--;
+        half = (t_MemNode*)OFFSET(node, ORDERSIZE(order));
+        SET_NEXT(half, GET_NEXT(node));
+        SET_NEXT(node, half);
+        _insertFree(e, half, order);
+    }
+}
+
+/**
+ * \brief Places order bitmaps at the start of the heap, the rest is
+ * covered by largest possible blocks.
+ */
+t_MemNode *_engineInit(t_Heap *heap)
+{
+    t_Engine *e = &heap->engine;
+    size_t mapsize = 0, offset = 0, words;
+    uint32_t *map = (uint32_t*)heap->start;
+    t_MemNode *node, *last = NULL;
+    int order;
+
+    e->minorder = _fls(MINBLOCK);
+    if (MINBLOCK & (ORDERSIZE(e->minorder) - 1))
+        e->minorder++;
+    e->maxorder = _fls(heap->size);
+
+    for (order = e->minorder; order <= e->maxorder; order++)
+        mapsize += ((heap->size >> order) + 31) / 32 * sizeof(uint32_t);
+    //no more than 1/64 of the heap is lost in front of the blocks
+    for (e->align = ALLOCATOR_BUDDY_ALIGN; e->align > BUDDY_ALIGN && e->align > heap->size / 64; e->align /= 2)
+        ;
+    if (e->align < BUDDY_ALIGN)
+        e->align = BUDDY_ALIGN;
+    e->base = (uint8_t*)(ALIGN_UP(OFFSET(heap->start, mapsize + SSIZE), e->align) - SSIZE);
+    mapsize = (uintptr_t)e->base - (uintptr_t)heap->start;
+    e->usable = (mapsize < heap->size ? heap->size - mapsize : 0);
+    e->maxorder = _fls(e->usable);
+
+    e->ordermap = 0;
+    for (order = e->minorder; order <= e->maxorder; order++)
+    {
+        words = ((e->usable >> order) + 31) / 32;
+        e->freemaps[order] = map;
+        e->freelists[order] = NULL;
+        for (size_t i = 0; i < words; i++)
+            map[i] = 0;
+        map += words;
+    }
+
+    while (e->usable - offset >= ORDERSIZE(e->minorder))
+    {
+        order = _fls(e->usable - offset);
+        node = (t_MemNode*)OFFSET(e->base, offset);
+        SET_NEXT(node, NULL);
+        if (last)
+            SET_NEXT(last, node);
+        _insertFree(e, node, order);
+        last = node;
+        offset += ORDERSIZE(order);
+    }
+    e->usable = offset;
+
+    guard(heap, (t_MemNode*)e->base);
+    return (t_MemNode*)e->base;
+}
+
+/**
+ * \brief Takes free block of smallest sufficient order, splitting
+ * larger block if needed.
+ *
+ * @param size_t size of block including node
+ * @return t_MemNode* allocated block or NULL
+ */
+t_MemNode *_engineAlloc(t_Heap *heap, size_t size)
+{
+    t_Engine *e = &heap->engine;
+    int order = _sizeOrder(e, size), found;
+    uint64_t map;
+    t_MemNode *node;
+
+    if (order > e->maxorder)
+        return NULL;
+
+    map = e->ordermap & ~(ORDERSIZE(order) - 1);
+    if (!map)
+        return NULL;
+
+    found = __builtin_ctzll(map);
+    node = e->freelists[found];
+    guard(heap, node);
+    _removeFree(e, node, found);
+    _splitBlock(e, node, found, order);
+    SET_BLOCKUSED(node, ORDERSIZE(order));
+    return node;
+}
+
+/**
+ * \brief Takes block of order large enough for both size and alignment.
+ *
+ * @return t_MemNode* allocated block or NULL if alignment is larger than
+ * alignment of the heap or there is no free block
+ */
+t_MemNode *_engineAllocAligned(t_Heap *heap, size_t size, size_t alignment)
+{
+    if (alignment > heap->engine.align)
+        return NULL;
+    return _engineAlloc(heap, (size < alignment ? alignment : size));
+}
+
+/**
+ * \brief Marks block as free and merges it with its buddies as long
+ * as they are free.
+ */
+void _engineFree(t_Heap *heap, t_MemNode *node)
+{
+    t_Engine *e = &heap->engine;
+    int order = _fls(GET_BLOCKSIZE(node));
+    size_t offset, buddyoffset;
+    t_MemNode *buddy;
+
+    while (order < e->maxorder)
+    {
+        offset = (uintptr_t)node - (uintptr_t)e->base;
+        buddyoffset = offset ^ ORDERSIZE(order);
+        if (buddyoffset + ORDERSIZE(order) > e->usable)
+            break;
+
+        buddy = (t_MemNode*)OFFSET(e->base, buddyoffset);
+        if (!_isFree(e, buddyoffset, order))
+            break;
+
+        _removeFree(e, buddy, order);
+        if (buddy < node)
+        {
+            SET_NEXT(buddy, GET_NEXT(node));
+            node = buddy;
+        }
+        else
+            SET_NEXT(node, GET_NEXT(buddy));
+        order++;
+    }
+    _insertFree(e, node, order);
+}
+
+/**
+ * \brief Allocates up to count blocks of size bytes. Every allocation
+ * takes constant time, so blocks are taken one by one.
+ *
+ * @return size_t number of blocks allocated
+ */
+size_t _engineAllocBatch(t_Heap *heap, size_t size, size_t count, t_MemNode **nodes)
+{
+    size_t done = 0;
+
+    while (done < count && (nodes[done] = _engineAlloc(heap, size)))
+        done++;
+    return done;
+}
+
+/**
+ * \brief Frees count used blocks, every one is merged with its buddies at once.
+ */
+void _engineFreeBatch(t_Heap *heap, t_MemNode **nodes, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        _engineFree(heap, nodes[i]);
+}
+
+/**
+ * \brief Resizes block in place. Shrinking releases upper halves, growing
+ * takes buddies of the block order by order if all of them are free.
+ * When block wasn't the left buddy, data is moved to the start of merged block.
+ *
+ * @return t_MemNode* node (or merged block it was moved to) or NULL if
+ * some of buddies is in use
+ */
+t_MemNode *_engineResize(t_Heap *heap, t_MemNode *node, size_t size)
+{
+    t_Engine *e = &heap->engine;
+    int order = _fls(GET_BLOCKSIZE(node)), target = _sizeOrder(e, size);
+    size_t offset = (uintptr_t)node - (uintptr_t)e->base, start, end;
+    t_MemNode *merged;
+
+    if (target > order)
+    {
+        if (target > e->maxorder)
+            return NULL;
+        start = offset & ~(ORDERSIZE(target) - 1);
+        end = start + ORDERSIZE(target);
+        if (end > e->usable)
+            return NULL;
+
+        for (int o = order; o < target; o++)
+            if (!_isFree(e, (offset & ~(ORDERSIZE(o) - 1)) ^ ORDERSIZE(o), o))
+                return NULL;
+
+        for (int o = order; o < target; o++)
+            _removeFree(e, (t_MemNode*)OFFSET(e->base, (offset & ~(ORDERSIZE(o) - 1)) ^ ORDERSIZE(o)), o);
+
+        merged = (t_MemNode*)OFFSET(e->base, start);
+        if (merged != node)
+            _amemcopy((void*)OFFSET(merged, SSIZE), (void*)OFFSET(node, SSIZE), ORDERSIZE(order) - SSIZE);
+        SET_NEXT(merged, (end < e->usable ? (t_MemNode*)OFFSET(e->base, end) : NULL));
+        SET_BLOCKUSED(merged, ORDERSIZE(target));
+        return merged;
+    }
+
+    _splitBlock(e, node, order, target);
+    SET_BLOCKUSED(node, ORDERSIZE(target));
+    return node;
+}
+
+/**
+ * \brief Placement is given by orders, engine has only HEAP_FIT_BEST.
+ */
+int _engineSetPolicy(t_Heap *heap, t_HeapPolicy policy)
+{
+    (void)heap;
+    return (policy == HEAP_FIT_BEST);
+}
+
+#ifdef ALLOCATOR_STATS
+/**
+ * \brief Size of the highest order with free block.
+ */
+size_t _engineLargest(t_Heap *heap)
+{
+    t_Engine *e = &heap->engine;
+
+    return (e->ordermap ? ORDERSIZE(_fls(e->ordermap)) : 0);
+}
+#endif
@@ -0,0 +1,350 @@
+/*
+ * handle.c
+ * Movable blocks, used when ALLOCATOR_HANDLES is defined.
+ * Block allocated by handle is reached only through its handle, program
+ * locks handle to get address of the block and unlocks it when it's done
+ * with it. Unlocked blocks are slid down the heap by compaction, so free
+ * space scattered between them is joined in one block.
+ * Handles are slots of chunks allocated from the heap, chunks are never
+ * freed, so handle stays valid as long as the heap. Block keeps address
+ * of its slot in front of payload given to the program, compaction finds
+ * handle of every used block by it. Block is moved only if that address
+ * lies in one of the chunks and the slot points back to the block, so
+ * any other block, e.g. one allocated by _amalloc(), stays where it is.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+#include <allocator_lib.h>
+
+#if defined(ALLOCATOR_ENGINE_TLSF) || defined(ALLOCATOR_ENGINE_BUDDY)
+#error "ALLOCATOR_HANDLES works only with list engine"
+#endif
+#ifdef ALLOCATOR_PERSIST
+#error "ALLOCATOR_HANDLES can't be used with ALLOCATOR_PERSIST"
+#endif
+
+#ifdef ALLOCATOR_POOLS
+#define NEXTPOOL(HEAP) __atomic_load_n(&(HEAP)->pool, __ATOMIC_ACQUIRE)
+#else
+#define NEXTPOOL(HEAP) NULL
+#endif
+
+/*
+ * Address of the slot is kept in front of payload, aligned, so payload
+ * stays aligned to ALLOCATOR_ALIGNMENT.
+ */
+#define HSIZE ALIGN_UP(sizeof(t_Handle), ALLOCATOR_ALIGNMENT)
+#define HANDLEOF(MEM) (*(t_Handle*)(MEM))
+
+/*! \struct _handle
+ * \brief Slot of handle, address of the block as given by the heap and
+ * pool it lies in. Lock count and address are changed under lock of
+ * that pool, the one compaction of the pool takes. Free slots are
+ * linked in list of the heap and have no block.
+ */
+struct _handle
+{
+    uintptr_t *mem;
+    t_Heap *heap;
+    size_t locks;
+    t_Handle nextfree;
+};
+
+/*! \struct _handle_chunk
+ * \brief Chunk of slots, every one is twice as large as the previous one.
+ * Chunks are linked from the newest one and never freed.
+ */
+struct _handle_chunk
+{
+    t_HandleChunk *next;
+    size_t count;
+    struct _handle slots[];
+};
+
+/**
+ * \brief Finds pool of the heap which holds mem, heap itself if none
+ * does (e.g. mapped block).
+ */
+static t_Heap *_handlePool(t_Heap *heap, uintptr_t *mem)
+{
+    for (t_Heap *pool = heap; pool; pool = NEXTPOOL(pool))
+        if ((uint8_t*)mem >= pool->start && (uint8_t*)mem < pool->start + pool->size)
+            return pool;
+    return heap;
+}
+
+/**
+ * \brief Takes free slot of the heap, allocating new chunk if there is none.
+ *
+ * @return t_Handle slot or NULL if there is no memory for new chunk
+ */
+static t_Handle _handleSlot(t_Heap *heap)
+{
+    t_HandleChunk *chunk;
+    t_Handle slot;
+    size_t count;
+
+    HEAP_LOCK(heap);
+    slot = heap->freehandle;
+    if (slot)
+        heap->freehandle = slot->nextfree;
+    count = (heap->handles ? heap->handles->count * 2 : ALLOCATOR_HANDLES_CHUNK);
+    HEAP_UNLOCK(heap);
+    if (slot)
+        return slot;
+
+    chunk = _ahmalloc(heap, sizeof(t_HandleChunk) + count * sizeof(struct _handle));
+    if (!chunk)
+        return NULL;
+    chunk->count = count;
+    chunk->slots[0].mem = NULL;
+    for (size_t i = 1; i < count; i++)
+    {
+        chunk->slots[i].mem = NULL;
+        chunk->slots[i].nextfree = (i + 1 < count ? &chunk->slots[i + 1] : NULL);
+    }
+
+    //first slot is taken, rest goes in front of slots freed meanwhile
+    HEAP_LOCK(heap);
+    if (count > 1)
+    {
+        chunk->slots[count - 1].nextfree = heap->freehandle;
+        heap->freehandle = &chunk->slots[1];
+    }
+    chunk->next = heap->handles;
+    __atomic_store_n(&heap->handles, chunk, __ATOMIC_RELEASE);
+    HEAP_UNLOCK(heap);
+    return &chunk->slots[0];
+}
+
+/**
+ * \brief Puts slot back in free list of the heap.
+ */
+static void _handleRelease(t_Heap *heap, t_Handle handle)
+{
+    HEAP_LOCK(heap);
+    handle->nextfree = heap->freehandle;
+    heap->freehandle = handle;
+    HEAP_UNLOCK(heap);
+}
+
+/**
+ * \brief Allocates movable block from given heap.
+ *
+ * @param t_Heap* heap
+ * @param size_t size of memory block needed
+ * @return t_Handle handle of the block or NULL if there is no memory
+ */
+t_Handle _ahmallochandle(t_Heap *heap, size_t size)
+{
+    t_Handle handle;
+    uintptr_t *mem;
+    t_Heap *pool;
+
+    if (size > SIZE_MAX - HSIZE)
+        return NULL;
+
+    //slot is taken first, so chunk lies below the block
+    handle = _handleSlot(BASEHEAP(heap));
+    if (!handle)
+        return NULL;
+    mem = _ahmalloc(heap, HSIZE + size);
+    if (!mem)
+    {
+        _handleRelease(BASEHEAP(heap), handle);
+        return NULL;
+    }
+
+    pool = _handlePool(BASEHEAP(heap), mem);
+    HEAP_LOCK(pool);
+    HANDLEOF(mem) = handle;
+    handle->mem = mem;
+    handle->heap = pool;
+    handle->locks = 0;
+    HEAP_UNLOCK(pool);
+    return handle;
+}
+
+/**
+ * \brief Locks block of handle in place, until it's unlocked as many
+ * times as it was locked.
+ *
+ * @return void* current address of the block or NULL if handle is NULL
+ */
+void *_alockhandle(t_Handle handle)
+{
+    void *ptr;
+
+    if (!handle)
+        return NULL;
+
+    HEAP_LOCK(handle->heap);
+    handle->locks++;
+    ptr = (void*)OFFSET(handle->mem, HSIZE);
+    HEAP_UNLOCK(handle->heap);
+    return ptr;
+}
+
+/**
+ * \brief Unlocks block of handle, address given by _alockhandle() can't
+ * be used anymore.
+ */
+void _aunlockhandle(t_Handle handle)
+{
+    if (!handle)
+        return;
+
+    HEAP_LOCK(handle->heap);
+    if (handle->locks)
+        handle->locks--;
+    HEAP_UNLOCK(handle->heap);
+}
+
+/**
+ * \brief Resizes block of unlocked handle, block may be moved.
+ *
+ * Handle is locked while block is reallocated, so it's not moved by
+ * compaction in the meantime.
+ *
+ * @return int 1 if block was resized, 0 if handle is locked or there is no memory
+ */
+int _areallochandle(t_Handle handle, size_t size)
+{
+    t_Heap *pool;
+    uintptr_t *mem, *newmem;
+
+    if (!handle || size > SIZE_MAX - HSIZE)
+        return 0;
+
+    pool = handle->heap;
+    HEAP_LOCK(pool);
+    mem = (handle->locks ? NULL : handle->mem);
+    if (mem)
+        handle->locks = 1;
+    HEAP_UNLOCK(pool);
+    if (!mem)
+        return 0;
+
+    newmem = _ahrealloc(BASEHEAP(pool), mem, HSIZE + size);
+    if (newmem)
+    {
+        pool = _handlePool(BASEHEAP(pool), newmem);
+        HEAP_LOCK(pool);
+        handle->mem = newmem;
+        handle->heap = pool;
+        handle->locks = 0;
+        HEAP_UNLOCK(pool);
+        return 1;
+    }
+
+    HEAP_LOCK(pool);
+    handle->locks = 0;
+    HEAP_UNLOCK(pool);
+    return 0;
+}
+
+/**
+ * \brief Frees block of handle, handle can't be used anymore.
+ */
+void _afreehandle(t_Handle handle)
+{
+    t_Heap *pool;
+    uintptr_t *mem;
+
+    if (!handle)
+        return;
+
+    pool = handle->heap;
+    HEAP_LOCK(pool);
+    mem = handle->mem;
+    handle->mem = NULL;
+    HEAP_UNLOCK(pool);
+
+    _ahfree(BASEHEAP(pool), mem);
+    _handleRelease(BASEHEAP(pool), handle);
+}
+
+/**
+ * \brief Finds handle of used block.
+ *
+ * Address in front of payload has to lie at slot of one of chunks of
+ * the heap and the slot has to hold the block, otherwise block wasn't
+ * allocated by handle. Pool lock has to be taken.
+ *
+ * @return t_Handle handle or NULL if block has none
+ */
+static t_Handle _handleOf(t_Heap *heap, t_MemNode *node)
+{
+    uintptr_t *mem = (uintptr_t*)OFFSET(node, SSIZE);
+    t_HandleChunk *chunk = __atomic_load_n(&BASEHEAP(heap)->handles, __ATOMIC_ACQUIRE);
+    uintptr_t slot;
+
+    if (GET_BLOCKSIZE(node) < SSIZE + HSIZE)
+        return NULL;
+
+    slot = (uintptr_t)HANDLEOF(mem);
+    for (; chunk; chunk = chunk->next)
+    {
+        if (slot < (uintptr_t)chunk->slots ||
+            slot >= (uintptr_t)(chunk->slots + chunk->count) ||
+            (slot - (uintptr_t)chunk->slots) % sizeof(struct _handle))
+            continue;
+        return (((t_Handle)slot)->mem == mem ? (t_Handle)slot : NULL);
+    }
+    return NULL;
+}
+
+/**
+ * \brief Lets compaction move used block to address to, if it belongs to
+ * unlocked handle, and points handle to its new place. Pool lock has to be taken.
+ *
+ * @return int 1 if block may be moved
+ */
+int _handleMove(t_Heap *heap, t_MemNode *node, t_MemNode *to)
+{
+    t_Handle handle = _handleOf(heap, node);
+
+    if (!handle || handle->locks)
+        return 0;
+
+    handle->mem = (uintptr_t*)OFFSET(to, SSIZE);
+    return 1;
+}
+
+/**
+ * \brief Compacts given heap and its pools.
+ *
+ * Blocks cached by calling thread are returned to the heap first, blocks
+ * cached by other threads stay where they are, as all used blocks
+ * without handle and locked ones.
+ *
+ * @param t_Heap* heap
+ * @return size_t largest payload which can be allocated from the heap
+ * or any of its pools after compaction
+ */
+size_t _ahcompact(t_Heap *heap)
+{
+    size_t largest = 0, size;
+
+#ifdef ALLOCATOR_THREADSAFE
+    _athreadflush();
+#endif
+    for (t_Heap *pool = heap; pool; pool = NEXTPOOL(pool))
+    {
+        if (!pool->firstblock)
+            continue;
+        HEAP_LOCK(pool);
+        size = _engineCompact(pool);
+        STAT_ENGINE(pool, 0);
+        HEAP_UNLOCK(pool);
+        if (size > largest)
+            largest = size;
+    }
+    return (largest > SSIZE ? largest - SSIZE : 0);
+}
@@ -0,0 +1,821 @@
+/*
+ * list.c
+ * List engine, default engine of the library.
+ * Every block, either used or free, is a node of singly linked list,
+ * allocation searches whole list for the smallest free block
+ * big enough to fit requested size.
+ * With ALLOCATOR_BOUNDARY_TAGS each node also points to previous
+ * block, so freed block is merged with its neighbours right away.
+ * With ALLOCATOR_FREE_LIST free blocks are additionally linked in
+ * separate list, which is the only one searched during allocation.
+ * With ALLOCATOR_STATS size of largest free block is kept, together
+ * with size no other free block exceeds. Search for smallest fit finds
+ * both on the way, other policies walk free blocks only if rest of
+ * taken largest block may be smaller than some other free block.
+ * Placement policy of the heap can be changed from best fit to first
+ * fit, next fit or best of few fitting blocks in address order, with
+ * free list it's then kept in address order.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+#include <allocator_lib.h>
+#include <assert.h>
+
+#ifdef ALLOCATOR_USEREPORT
+#include <stdio.h>
+#endif
+
+#ifdef ALLOCATOR_STATS
+#define LARGEST(HEAP, SIZE) _largest(HEAP, SIZE)
+#else
+#define LARGEST(HEAP, SIZE) ((void)0)
+#endif
+
+#ifdef ALLOCATOR_FREE_LIST
+#define FIRSTFREE(HEAP) ((HEAP)->engine.freelist)
+#define NEXTFREE(NODE) (FREELINKS(NODE)->nextfree)
+#define PREVFREE(NODE) (FREELINKS(NODE)->prevfree)
+#else
+#define FIRSTFREE(HEAP) ((HEAP)->firstblock)
+#define NEXTFREE(NODE) GET_NEXT(NODE)
+#define PREVFREE(NODE) NULL
+#endif
+
+#ifdef ALLOCATOR_STATS
+/**
+ * \brief Notes free block of given size. Largest free block is kept
+ * exact, second is only bound, blocks taken or joined since the last
+ * walk may have been larger than the rest.
+ */
+static void _largest(t_Heap *heap, size_t size)
+{
+    if (size > heap->engine.largest)
+    {
+        heap->engine.second = heap->engine.largest;
+        heap->engine.largest = size;
+    }
+    else if (size > heap->engine.second)
+        heap->engine.second = size;
+}
+#endif
+
+#ifdef ALLOCATOR_FREE_LIST
+/**
+ * \brief Unlinks free block from free list. Next fit search, which
+ * stopped at it, resumes at the following one.
+ */
+static void _removeFree(t_Heap *heap, t_MemNode *node)
+{
+    t_FreeLinks *links = FREELINKS(node);
+
+    if (heap->engine.rover == node)
+        heap->engine.rover = links->nextfree;
+
+    if (links->nextfree)
+        FREELINKS(links->nextfree)->prevfree = links->prevfree;
+    if (links->prevfree)
+        FREELINKS(links->prevfree)->nextfree = links->nextfree;
+    else
+        heap->engine.freelist = links->nextfree;
+}
+
+/**
+ * \brief Returns free block after which freed block is put on free list.
+ * With HEAP_FIT_ADDRESS policy it's free block lying before it, found by
+ * walking back through the blocks between them, otherwise NULL, freed
+ * block goes to the head of free list.
+ */
+static t_MemNode *_prevFree(t_Heap *heap, t_MemNode *node)
+{
+    t_MemNode *prev = NULL;
+
+    if (heap->policy == HEAP_FIT_ADDRESS)
+        for (prev = GET_PREV(node); prev && !BLOCK_ISFREE(prev); prev = GET_PREV(prev))
+            ;
+    return prev;
+}
+
+/**
+ * \brief Puts free block on free list right after prev, or at its head if
+ * prev is NULL.
+ */
+static void _insertFree(t_Heap *heap, t_MemNode *node, t_MemNode *prev)
+{
+    t_FreeLinks *links = FREELINKS(node);
+
+    links->prevfree = prev;
+    links->nextfree = (prev ? FREELINKS(prev)->nextfree : heap->engine.freelist);
+    if (links->nextfree)
+        FREELINKS(links->nextfree)->prevfree = node;
+    if (prev)
+        FREELINKS(prev)->nextfree = node;
+    else
+        heap->engine.freelist = node;
+}
+#endif
+
+/**
+ * \brief Joins two adjacent blocks if they lie against each other.
+ *
+ * Merges two blocks toghether if nxt block is adjacent to src block
+ * and both blocks have BLOCK_FREE flag set or src block is used and
+ * nxt block has BLOCK_FREE flag set.
+ *
+ * @param t_MemNode* "left" block - will become new larger block
+ * @param t_MemNode* "right" block - will be merged to "left" block
+ * @return t_MemNode* address of "left" block or NULL if both blocks aren't adjacent.
+ */
+static t_MemNode *_joinBlocks(t_Heap *heap, t_MemNode *src, t_MemNode *nxt)
+{
+  size_t newsize;
+  if ((nxt && GET_NEXT(src) == nxt) &&
+      ((BLOCK_ISUSED(src) && BLOCK_ISFREE(nxt)) ||
+       (BLOCK_ISFREE(src) && BLOCK_ISFREE(nxt))))
+  {
+    newsize = GET_BLOCKSIZE(src) + GET_BLOCKSIZE(nxt);
+#ifdef ALLOCATOR_FREE_LIST
+    _removeFree(heap, nxt);
+#endif
+    SET_NEXT(src, GET_NEXT(nxt));
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+    if (GET_NEXT(src))
+        SET_PREV(GET_NEXT(src), src);
+#endif
+    SET_BLOCKSIZE(src, newsize);
+    if (heap->engine.rover == nxt)
+        heap->engine.rover = src;
+  }
+  return src;
+}
+
+/**
+ * \brief Splits given block in two and return src address.
+ *
+ * src block will be splitted at given offset, src block will be
+ * trimmed to "offset" size, new block will start right after src
+ * and the last one will be marked as free and joined as next to the
+ * src block. If offset is grater than size of src block, function
+ * return src and src block will stay intact. With free list, new
+ * block has to be at least MINBLOCK large and is put on it right after
+ * prevfree, in place of free block it was cut from or which follows it,
+ * so free list stays in address order without walking the blocks.
+ *
+ * @param t_MemNode* source block
+ * @param size_t offset of byte where
+ * @param t_MemNode* free block after which new block is put on free list
+ */
+static t_MemNode *_splitBlock(t_Heap *heap, t_MemNode *src, size_t offset, t_MemNode *prevfree)
+{
+  t_MemNode *next;
+  size_t size1, size2;
+
+  if(src && offset > 0)
+  {
+      size1 = offset;
+      if (size1 % ALLOCATOR_ALIGNMENT)
+          size1 = size1 + ALLOCATOR_ALIGNMENT - (size1 % ALLOCATOR_ALIGNMENT);
+      size2 = GET_BLOCKSIZE(src) - size1;
+
+#ifdef ALLOCATOR_FREE_LIST
+      if (GET_BLOCKSIZE(src) >= size1 + MINBLOCK)
+#else
+      if (size2 > SSIZE)
+#endif
+      {
+          SET_BLOCKUSED(src, size1);
+          next = (t_MemNode*)OFFSET(src, size1);
+          SET_BLOCKFREE(next, size2);
+          SET_NEXT(next, GET_NEXT(src));
+          SET_NEXT(src, next);
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+          SET_PREV(next, src);
+          if (GET_NEXT(next))
+              SET_PREV(GET_NEXT(next), next);
+#endif
+#ifdef ALLOCATOR_FREE_LIST
+          _insertFree(heap, next, prevfree);
+#else
+          (void)heap;
+          (void)prevfree;
+#endif
+      }
+  }
+  return src;
+}
+
+#ifndef ALLOCATOR_BOUNDARY_TAGS
+/**
+ * \brief _tieAdjacent - consolidates adjacent free memory blocks.
+ *
+ * Prevents excessive memory fragmentation when malloc and free are heavily called
+ * especially with huge amount of small memory blocks are massively freed.
+ * Called when allocation finds no block and after each deallocation.
+ * Whole list is walked, with ALLOCATOR_STATS largest free block is
+ * found on the way.
+ * This function is static.
+ */
+static void _tieAdjacent(t_Heap *heap)
+{
+  t_MemNode *start = heap->firstblock;
+  t_MemNode *ntmp = start;
+  guard(heap, start);
+
+#ifdef ALLOCATOR_STATS
+  heap->engine.largest = heap->engine.second = 0;
+#endif
+  while(start)
+  {
+
+      ntmp = GET_NEXT(start);
+      guard(heap, ntmp);
+
+      //whole run of free blocks is joined at once
+      while (BLOCK_ISFREE(start) && ntmp && BLOCK_ISFREE(ntmp))
+      {
+	 start = _joinBlocks(heap, start, ntmp);
+	 ntmp = GET_NEXT(start);
+      }
+      if (BLOCK_ISFREE(start))
+          LARGEST(heap, GET_BLOCKSIZE(start));
+
+      start = GET_NEXT(start);
+  }
+}
+#endif
+
+/**
+ * \brief Tries to find smallest free memory block.
+ *
+ * Function traverses list of memory blocks and tries to
+ * find memory block size in which requested by size block of memory can fit.
+ * With free list only free blocks are traversed.
+ * This function is static.
+ *
+ * @param size_t requested size
+ * @return t_MemNode address of found memory block or NULL
+ */
+t_MemNode *_findSmallestFit(t_Heap *heap, size_t size)
+{
+    size_t foundsize = heap->size + 1;
+#ifdef ALLOCATOR_FREE_LIST
+    t_MemNode *node = heap->engine.freelist, *found = NULL;
+#else
+    t_MemNode *node = heap->firstblock, *found = NULL;
+#endif
+#ifdef ALLOCATOR_STATS
+    t_MemNode *largest = NULL;
+    size_t first = 0, second = 0;
+#endif
+
+    if (size > heap->size)
+        return found;
+
+    while(node)
+    {
+        if (BLOCK_ISFREE(node) && GET_BLOCKSIZE(node) < foundsize && size <= GET_BLOCKSIZE(node))
+        {
+	  found = node;
+          foundsize = GET_BLOCKSIZE(node);
+        }
+#ifdef ALLOCATOR_STATS
+        if (BLOCK_ISFREE(node) && GET_BLOCKSIZE(node) > second)
+        {
+            if (GET_BLOCKSIZE(node) > first)
+            {
+                second = first;
+                first = GET_BLOCKSIZE(node);
+                largest = node;
+            }
+            else
+                second = GET_BLOCKSIZE(node);
+        }
+#endif
+#ifdef ALLOCATOR_FREE_LIST
+        node = FREELINKS(node)->nextfree;
+#else
+        node = GET_NEXT(node);
+#endif
+    }
+    guard(heap, node);
+#ifdef ALLOCATOR_STATS
+    //largest of blocks left free, rest of found block is added after split
+    heap->engine.largest = (found && found == largest ? second : first);
+    heap->engine.second = second;
+#endif
+    return found;
+}
+
+/**
+ * \brief Returns first free block of at least size bytes, searching from
+ * node up to stop (or to the end of the list if stop is NULL).
+ */
+static t_MemNode *_findFirstFit(t_MemNode *node, t_MemNode *stop, size_t size)
+{
+    for (; node && node != stop; node = NEXTFREE(node))
+        if (BLOCK_ISFREE(node) && size <= GET_BLOCKSIZE(node))
+            return node;
+    return NULL;
+}
+
+/**
+ * \brief Returns first free block of at least size bytes, searching from
+ * block where last search stopped to the end and then from the start.
+ */
+static t_MemNode *_findNextFit(t_Heap *heap, size_t size)
+{
+    t_MemNode *start = (heap->engine.rover ? heap->engine.rover : FIRSTFREE(heap));
+    t_MemNode *found = _findFirstFit(start, NULL, size);
+
+    if (!found && start != FIRSTFREE(heap))
+        found = _findFirstFit(FIRSTFREE(heap), start, size);
+    heap->engine.rover = found;
+    return found;
+}
+
+/**
+ * \brief Returns smallest of first ALLOCATOR_FIT_SEARCH free blocks of at
+ * least size bytes, the one with the lowest address of equal ones.
+ * Block list is always in address order, free list is kept in it.
+ */
+static t_MemNode *_findAddressFit(t_Heap *heap, size_t size)
+{
+    t_MemNode *node, *found = NULL;
+    size_t left = ALLOCATOR_FIT_SEARCH;
+
+    for (node = FIRSTFREE(heap); node && left; node = NEXTFREE(node))
+    {
+        if (!BLOCK_ISFREE(node) || size > GET_BLOCKSIZE(node))
+            continue;
+        if (!found || GET_BLOCKSIZE(node) < GET_BLOCKSIZE(found))
+            found = node;
+        if (GET_BLOCKSIZE(node) == size)
+            break;
+        left--;
+    }
+    return found;
+}
+
+/**
+ * \brief Finds free block of at least size bytes, as placement policy
+ * of the heap says.
+ */
+static t_MemNode *_findFit(t_Heap *heap, size_t size)
+{
+    switch (heap->policy)
+    {
+    case HEAP_FIT_FIRST:
+        return _findFirstFit(FIRSTFREE(heap), NULL, size);
+    case HEAP_FIT_NEXT:
+        return _findNextFit(heap, size);
+    case HEAP_FIT_ADDRESS:
+        return _findAddressFit(heap, size);
+    default:
+        return _findSmallestFit(heap, size);
+    }
+}
+
+#ifdef ALLOCATOR_STATS
+/**
+ * \brief Walks free blocks to find the largest one and the one after it.
+ */
+static void _findLargest(t_Heap *heap)
+{
+#ifdef ALLOCATOR_FREE_LIST
+    t_MemNode *node = heap->engine.freelist;
+#else
+    t_MemNode *node = heap->firstblock;
+#endif
+
+    heap->engine.largest = heap->engine.second = 0;
+    while (node)
+    {
+        if (BLOCK_ISFREE(node))
+            LARGEST(heap, GET_BLOCKSIZE(node));
+#ifdef ALLOCATOR_FREE_LIST
+        node = FREELINKS(node)->nextfree;
+#else
+        node = GET_NEXT(node);
+#endif
+    }
+}
+
+/**
+ * \brief Size of largest free block.
+ */
+size_t _engineLargest(t_Heap *heap)
+{
+    return heap->engine.largest;
+}
+#endif
+
+/**
+ * \brief Makes whole heap a single free block.
+ */
+t_MemNode *_engineInit(t_Heap *heap)
+{
+    t_MemNode *node = (t_MemNode*) heap->start;
+
+    SET_NEXT(node, NULL);
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+    SET_PREV(node, NULL);
+#endif
+    SET_BLOCKFREE(node, heap->size);
+    guard(heap, node);
+    heap->engine.freelist = NULL;
+    heap->engine.rover = NULL;
+#ifdef ALLOCATOR_FREE_LIST
+    _insertFree(heap, node, NULL);
+#endif
+#ifdef ALLOCATOR_STATS
+    heap->engine.largest = heap->size;
+    heap->engine.second = 0;
+#endif
+    return node;
+}
+
+/**
+ * \brief Sets placement policy of the heap. Free list is made again, in
+ * address order, which any policy can start with.
+ *
+ * @return int 1, list engine has every policy
+ */
+int _engineSetPolicy(t_Heap *heap, t_HeapPolicy policy)
+{
+#ifdef ALLOCATOR_FREE_LIST
+    t_MemNode *last = NULL;
+#endif
+
+    heap->policy = policy;
+    heap->engine.rover = NULL;
+#ifdef ALLOCATOR_FREE_LIST
+    heap->engine.freelist = NULL;
+    for (t_MemNode *node = heap->firstblock; node; node = GET_NEXT(node))
+        if (BLOCK_ISFREE(node))
+        {
+            _insertFree(heap, node, last);
+            last = node;
+        }
+#endif
+    return 1;
+}
+
+/**
+ * \brief Finds fitting block and cuts requested size from it.
+ *
+ * If no block was found, adjacent free blocks are consolidated and
+ * search is repeated. With boundary tags free blocks are never adjacent,
+ * so there is nothing to consolidate. Search of other policy than best
+ * fit doesn't walk all blocks, largest free block is searched for only
+ * when it was taken and rest of it may be smaller than other free block.
+ *
+ * @param size_t size of block including node
+ * @return t_MemNode* allocated block or NULL
+ */
+t_MemNode *_engineAlloc(t_Heap *heap, size_t size)
+{
+    t_MemNode *node;
+
+#ifdef ALLOCATOR_FREE_LIST
+    if (size < MINBLOCK)
+        size = MINBLOCK;
+#endif
+
+    node = _findFit(heap, size);
+#ifndef ALLOCATOR_BOUNDARY_TAGS
+    if (!node)
+    {
+        _tieAdjacent(heap);
+        node = _findFit(heap, size);
+    }
+#endif
+    guard(heap, node);
+
+    if (node)
+    {
+        //rest of the block takes its place on free list
+        t_MemNode *prevfree = PREVFREE(node);
+#ifdef ALLOCATOR_STATS
+        size_t taken = GET_BLOCKSIZE(node), rest;
+#endif
+#ifdef ALLOCATOR_FREE_LIST
+        _removeFree(heap, node);
+#endif
+        MARK_BLOCKUSED(node);
+        node = _splitBlock(heap, node, size, prevfree);
+        guard(heap, node);
+#ifdef ALLOCATOR_STATS
+        rest = (GET_NEXT(node) && BLOCK_ISFREE(GET_NEXT(node)) ? GET_BLOCKSIZE(GET_NEXT(node)) : 0);
+        if (heap->policy != HEAP_FIT_BEST && taken >= heap->engine.largest)
+        {
+            //no other free block exceeds second, rest is the largest one if it doesn't either
+            heap->engine.largest = rest;
+            if (rest < heap->engine.second)
+                _findLargest(heap);
+        }
+        else
+            LARGEST(heap, rest);
+#endif
+    }
+    return node;
+}
+
+/**
+ * \brief Takes block big enough for size and any alignment gap, cuts
+ * aligned block out of it. Gap in front of it is freed, rest after it
+ * is cut off like on shrinking.
+ *
+ * @param size_t size of block including node
+ * @param size_t alignment of payload
+ * @return t_MemNode* allocated block or NULL
+ */
+t_MemNode *_engineAllocAligned(t_Heap *heap, size_t size, size_t alignment)
+{
+    t_MemNode *node, *next;
+    size_t gap;
+
+#ifdef ALLOCATOR_FREE_LIST
+    if (size < MINBLOCK)
+        size = MINBLOCK;
+#endif
+
+    node = _engineAlloc(heap, size + alignment + MINBLOCK);
+    if (!node)
+        return NULL;
+
+    gap = _alignGap(node, alignment);
+    if (gap)
+    {
+        //aligned block is taken right away, its place on free list doesn't matter
+        _splitBlock(heap, node, gap, NULL);
+        next = GET_NEXT(node);
+#ifdef ALLOCATOR_FREE_LIST
+        _removeFree(heap, next);
+#endif
+        MARK_BLOCKUSED(next);
+        _engineFree(heap, node);
+        node = next;
+    }
+    return _engineResize(heap, node, size);
+}
+
+/**
+ * \brief Marks block as free and consolidates whole list.
+ *
+ * With boundary tags only right and left neighbours are joined.
+ */
+void _engineFree(t_Heap *heap, t_MemNode *node)
+{
+    MARK_BLOCKFREE(node);
+#ifdef ALLOCATOR_FREE_LIST
+    _insertFree(heap, node, _prevFree(heap, node));
+#endif
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+    node = _joinBlocks(heap, node, GET_NEXT(node));
+    if (GET_PREV(node) && BLOCK_ISFREE(GET_PREV(node)))
+        node = _joinBlocks(heap, GET_PREV(node), node);
+    LARGEST(heap, GET_BLOCKSIZE(node));
+#else
+    _tieAdjacent(heap);
+#endif
+}
+
+/**
+ * \brief Allocates up to count blocks of size bytes, cut out of one free
+ * block found by a single walk of the list.
+ *
+ * Block for all remaining blocks is searched first, if there is none,
+ * for half of them and so on. Found block is cut in blocks of given
+ * size, last one keeps rest which was too small to be split off.
+ *
+ * @param size_t size of every block including node
+ * @param t_MemNode** where allocated blocks are stored
+ * @return size_t number of blocks allocated
+ */
+size_t _engineAllocBatch(t_Heap *heap, size_t size, size_t count, t_MemNode **nodes)
+{
+    t_MemNode *node, *next;
+    size_t done = 0, part;
+
+#ifdef ALLOCATOR_FREE_LIST
+    if (size < MINBLOCK)
+        size = MINBLOCK;
+#endif
+
+    part = (count < heap->size / size ? count : heap->size / size);
+    while (done < count && part)
+    {
+        node = _engineAlloc(heap, part * size);
+        if (!node)
+        {
+            part /= 2;
+            continue;
+        }
+
+        for (size_t i = 1; i < part; i++)
+        {
+            next = (t_MemNode*)OFFSET(node, size);
+            SET_BLOCKUSED(next, GET_BLOCKSIZE(node) - size);
+            SET_NEXT(next, GET_NEXT(node));
+            SET_NEXT(node, next);
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+            SET_PREV(next, node);
+            if (GET_NEXT(next))
+                SET_PREV(GET_NEXT(next), next);
+#endif
+            SET_BLOCKUSED(node, size);
+            nodes[done++] = node;
+            node = next;
+        }
+        nodes[done++] = node;
+
+        if (part > count - done)
+            part = count - done;
+    }
+    return done;
+}
+
+/**
+ * \brief Marks count used blocks as free.
+ *
+ * Without boundary tags whole list is consolidated once for all of
+ * them, instead of once per block.
+ */
+void _engineFreeBatch(t_Heap *heap, t_MemNode **nodes, size_t count)
+{
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+    for (size_t i = 0; i < count; i++)
+        _engineFree(heap, nodes[i]);
+#else
+    if (!count)
+        return;
+    for (size_t i = 0; i < count; i++)
+        MARK_BLOCKFREE(nodes[i]);
+    _tieAdjacent(heap);
+#endif
+}
+
+/**
+ * \brief Resizes block in place, rest of the block is marked as free.
+ *
+ * Block which is too small takes following free blocks, if they are
+ * not enough and boundary tags are enabled, free block before it is
+ * taken as well and data is moved to its start.
+ *
+ * @return t_MemNode* node (or previous block it was moved to) or NULL
+ * if there is not enough free space around the block
+ */
+t_MemNode *_engineResize(t_Heap *heap, t_MemNode *node, size_t size)
+{
+    t_MemNode *next, *prevfree = NULL;
+    size_t oldsize = GET_BLOCKSIZE(node), avail = oldsize;
+
+#ifdef ALLOCATOR_FREE_LIST
+    if (size < MINBLOCK)
+        size = MINBLOCK;
+#endif
+
+    if (oldsize < size)
+    {
+        for (next = GET_NEXT(node); next && BLOCK_ISFREE(next) && avail < size; next = GET_NEXT(next))
+            avail += GET_BLOCKSIZE(next);
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+        if (avail < size && GET_PREV(node) && BLOCK_ISFREE(GET_PREV(node)))
+            avail += GET_BLOCKSIZE(GET_PREV(node));
+#endif
+        if (avail < size)
+            return NULL;
+
+        //rest cut off takes place of free block taken first
+        if (GET_NEXT(node) && BLOCK_ISFREE(GET_NEXT(node)))
+            prevfree = PREVFREE(GET_NEXT(node));
+        while (GET_BLOCKSIZE(node) < size && GET_NEXT(node) && BLOCK_ISFREE(GET_NEXT(node)))
+            node = _joinBlocks(heap, node, GET_NEXT(node));
+
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+        if (GET_BLOCKSIZE(node) < size)
+        {
+            t_MemNode *prev = GET_PREV(node);
+
+#ifdef ALLOCATOR_FREE_LIST
+            prevfree = PREVFREE(prev);
+            _removeFree(heap, prev);
+#endif
+            SET_NEXT(prev, GET_NEXT(node));
+            if (GET_NEXT(prev))
+                SET_PREV(GET_NEXT(prev), prev);
+            SET_BLOCKUSED(prev, GET_BLOCKSIZE(prev) + GET_BLOCKSIZE(node));
+            _amemcopy((void*)OFFSET(prev, SSIZE), (void*)OFFSET(node, SSIZE), oldsize - SSIZE);
+            if (heap->engine.rover == node)
+                heap->engine.rover = prev;
+            node = prev;
+        }
+#endif
+#ifdef ALLOCATOR_STATS
+        //largest free block might have been taken only if it's not larger than growth
+        if (GET_BLOCKSIZE(node) - oldsize >= heap->engine.largest)
+            _findLargest(heap);
+#endif
+    }
+#ifdef ALLOCATOR_FREE_LIST
+    //rest cut off goes in front of free block following it or is freed
+    else if (GET_NEXT(node) && BLOCK_ISFREE(GET_NEXT(node)))
+        prevfree = PREVFREE(GET_NEXT(node));
+    else
+        prevfree = _prevFree(heap, node);
+#endif
+
+    node = _splitBlock(heap, node, size, prevfree);
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+    if (GET_NEXT(node) && BLOCK_ISFREE(GET_NEXT(node)))
+        _joinBlocks(heap, GET_NEXT(node), GET_NEXT(GET_NEXT(node)));
+#endif
+    if (GET_NEXT(node) && BLOCK_ISFREE(GET_NEXT(node)))
+        LARGEST(heap, GET_BLOCKSIZE(GET_NEXT(node)));
+    return node;
+}
+
+#ifdef ALLOCATOR_HANDLES
+/**
+ * \brief Slides used blocks, which _handleMove() lets go, down over free
+ * space in front of them and joins all free blocks met on the way.
+ *
+ * Blocks keep their order, block which can't be moved stays and free
+ * space in front of it stays as well. When no block stays, all free
+ * space ends in single block at the end of the heap. Free list is made
+ * again from blocks left free.
+ *
+ * @return size_t size of largest free block, including node
+ */
+size_t _engineCompact(t_Heap *heap)
+{
+    t_MemNode *node, *next, *last = NULL, *to;
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+    t_MemNode *prev;
+#endif
+    size_t size, free, largest = 0;
+
+    heap->engine.rover = NULL;
+    for (node = heap->firstblock; node; node = next)
+    {
+        next = GET_NEXT(node);
+        if (last && BLOCK_ISFREE(last))
+        {
+            free = GET_BLOCKSIZE(last);
+            if (BLOCK_ISFREE(node))
+            {
+                SET_NEXT(last, next);
+                SET_BLOCKFREE(last, free + GET_BLOCKSIZE(node));
+                continue;
+            }
+            if (_handleMove(heap, node, last))
+            {
+                //node is copied with payload, its links are set again
+                to = last;
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+                prev = GET_PREV(to);
+#endif
+                size = GET_BLOCKSIZE(node);
+                _amemcopy(to, node, size);
+                last = (t_MemNode*)OFFSET(to, size);
+                SET_BLOCKFREE(last, free);
+                SET_NEXT(to, last);
+                SET_NEXT(last, next);
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+                SET_PREV(to, prev);
+                SET_PREV(last, to);
+#endif
+                continue;
+            }
+        }
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+        SET_PREV(node, last);
+#endif
+        last = node;
+    }
+
+    heap->engine.freelist = NULL;
+    last = NULL;
+#ifdef ALLOCATOR_STATS
+    heap->engine.largest = heap->engine.second = 0;
+#endif
+    for (node = heap->firstblock; node; node = GET_NEXT(node))
+    {
+        if (!BLOCK_ISFREE(node))
+            continue;
+#ifdef ALLOCATOR_FREE_LIST
+        _insertFree(heap, node, last);
+        last = node;
+#endif
+        if (GET_BLOCKSIZE(node) > largest)
+            largest = GET_BLOCKSIZE(node);
+        LARGEST(heap, GET_BLOCKSIZE(node));
+    }
+    return largest;
+}
+#endif
@@ -0,0 +1,158 @@
+/*
+ * memops.c
+ * Copy and fill kernels used whenever block data is copied, moved or cleared.
+ * Generic kernels work on whole machine words, on x86-64 SSE2 kernels
+ * are used by default and AVX2 ones are picked on first call when CPU
+ * supports them. All kernels go forward through memory, loading every
+ * chunk before storing it, so copy may also move data down to lower,
+ * overlapping address.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+#include <allocator_lib.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MEMOPS_X86
+#include <immintrin.h>
+#endif
+
+/*! \typedef t_Word
+ * \brief Machine word which may be accessed at any address.
+ */
+typedef uintptr_t __attribute__((may_alias, aligned(1))) t_Word;
+
+#define WSIZE sizeof(uintptr_t)
+
+typedef void (*t_CopyKernel)(uint8_t *dest, const uint8_t *src, size_t n);
+typedef void (*t_FillKernel)(uint8_t *dest, uint8_t value, size_t n);
+
+/**
+ * \brief Copies word at a time, tail byte at a time.
+ */
+static void _copyWords(uint8_t *dest, const uint8_t *src, size_t n)
+{
+    for (; n >= WSIZE; n -= WSIZE, dest += WSIZE, src += WSIZE)
+        *(t_Word*)dest = *(const t_Word*)src;
+    while (n--)
+        *dest++ = *src++;
+}
+
+/**
+ * \brief Fills word at a time, tail byte at a time.
+ */
+static void _fillWords(uint8_t *dest, uint8_t value, size_t n)
+{
+    uintptr_t word = ((uintptr_t)-1 / 0xFF) * value;
+
+    for (; n >= WSIZE; n -= WSIZE, dest += WSIZE)
+        *(t_Word*)dest = word;
+    while (n--)
+        *dest++ = value;
+}
+
+#ifdef MEMOPS_X86
+/**
+ * \brief Copies 16 bytes at a time, every x86-64 CPU has SSE2.
+ */
+static void _copySSE2(uint8_t *dest, const uint8_t *src, size_t n)
+{
+    for (; n >= 16; n -= 16, dest += 16, src += 16)
+        _mm_storeu_si128((__m128i*)dest, _mm_loadu_si128((const __m128i*)src));
+    _copyWords(dest, src, n);
+}
+
+static void _fillSSE2(uint8_t *dest, uint8_t value, size_t n)
+{
+    __m128i v = _mm_set1_epi8((char)value);
+
+    for (; n >= 16; n -= 16, dest += 16)
+        _mm_storeu_si128((__m128i*)dest, v);
+    _fillWords(dest, value, n);
+}
+
+/**
+ * \brief Copies 32 bytes at a time.
+ */
+__attribute__((target("avx2")))
+static void _copyAVX2(uint8_t *dest, const uint8_t *src, size_t n)
+{
+    for (; n >= 32; n -= 32, dest += 32, src += 32)
+        _mm256_storeu_si256((__m256i*)dest, _mm256_loadu_si256((const __m256i*)src));
+    _copySSE2(dest, src, n);
+}
+
+__attribute__((target("avx2")))
+static void _fillAVX2(uint8_t *dest, uint8_t value, size_t n)
+{
+    __m256i v = _mm256_set1_epi8((char)value);
+
+    for (; n >= 32; n -= 32, dest += 32)
+        _mm256_storeu_si256((__m256i*)dest, v);
+    _fillSSE2(dest, value, n);
+}
+#endif
+
+static void _copyFirst(uint8_t *dest, const uint8_t *src, size_t n);
+static void _fillFirst(uint8_t *dest, uint8_t value, size_t n);
+
+static t_CopyKernel copykernel = _copyFirst;
+static t_FillKernel fillkernel = _fillFirst;
+
+/**
+ * \brief Chooses best kernels for the CPU. Every thread would choose
+ * the same ones, so concurrent first calls are harmless.
+ */
+static void _pickKernels(void)
+{
+#ifdef MEMOPS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        copykernel = _copyAVX2;
+        fillkernel = _fillAVX2;
+    }
+    else
+    {
+        copykernel = _copySSE2;
+        fillkernel = _fillSSE2;
+    }
+#else
+    copykernel = _copyWords;
+    fillkernel = _fillWords;
+#endif
+}
+
+static void _copyFirst(uint8_t *dest, const uint8_t *src, size_t n)
+{
+    _pickKernels();
+    copykernel(dest, src, n);
+}
+
+static void _fillFirst(uint8_t *dest, uint8_t value, size_t n)
+{
+    _pickKernels();
+    fillkernel(dest, value, n);
+}
+
+/**
+ * \brief Copies n bytes from src to dest, dest may overlap src
+ * only if it lies below it.
+ */
+void _amemcopy(void *dest, const void *src, size_t n)
+{
+    copykernel((uint8_t*)dest, (const uint8_t*)src, n);
+}
+
+/**
+ * \brief Sets n bytes at dest to value.
+ */
+void _amemfill(void *dest, uint8_t value, size_t n)
+{
+    fillkernel((uint8_t*)dest, value, n);
+}
@@ -0,0 +1,159 @@
+/*
+ * mmap.c
+ * Large blocks and trimming, used when ALLOCATOR_MMAP is defined.
+ * Block of at least ALLOCATOR_MMAP_THRESHOLD bytes gets anonymous
+ * mapping of its own, so it neither fragments the heap nor is copied
+ * when it grows, mapping is just moved by mremap(). Block keeps usual
+ * node in the first page of its mapping, size of the node spans to the
+ * end of the mapping. Allocator tells mapped blocks apart by address,
+ * they lie outside of the heap and its pools.
+ * Trim gives pages inside free blocks of the heap back to the system.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#define _GNU_SOURCE
+#include <allocator.h>
+#include <allocator_lib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static size_t pagesize;
+
+static size_t _pageSize(void)
+{
+    if (!pagesize)
+        pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    return pagesize;
+}
+
+/*
+ * Node lies in the first page of mapping, pages in front of it
+ * are unmapped right after block is mapped.
+ */
+#define MAPSTART(NODE) ((uint8_t*)((uintptr_t)(NODE) & ~(uintptr_t)(_pageSize() - 1)))
+
+/**
+ * \brief Maps block with payload of at least size bytes, aligned to alignment.
+ *
+ * Alignment larger than page is found in mapping larger by the
+ * alignment, pages around the block are unmapped.
+ *
+ * @return void* address of payload or NULL if mapping failed
+ */
+void *_mmapAlloc(size_t alignment, size_t size)
+{
+    size_t page = _pageSize(), head, len;
+    uint8_t *map, *start, *end;
+    t_MemNode *node;
+
+    if (alignment & (alignment - 1))
+        return NULL;
+    if (alignment < ALLOCATOR_ALIGNMENT)
+        alignment = ALLOCATOR_ALIGNMENT;
+
+    head = (alignment > page ? alignment : ALIGN_UP(SSIZE, alignment));
+    if (head + page > NODE_MAXSIZE || size > NODE_MAXSIZE - head - page)
+        return NULL;
+    len = ALIGN_UP(head + size, page);
+
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    node = (t_MemNode*)(ALIGN_UP(map + SSIZE, alignment) - SSIZE);
+    start = MAPSTART(node);
+    end = (uint8_t*)ALIGN_UP(OFFSET(node, SSIZE + size), page);
+    if (start > map)
+        munmap(map, start - map);
+    if (end < map + len)
+        munmap(end, (map + len) - end);
+
+    SET_NEXT(node, NULL);
+    SET_BLOCKUSED(node, end - (uint8_t*)node);
+    return (void*)OFFSET(node, SSIZE);
+}
+
+/**
+ * \brief Unmaps block.
+ */
+void _mmapFree(void *mem)
+{
+    t_MemNode *node = (t_MemNode*) OFFSET(mem, -SSIZE);
+    uint8_t *map = MAPSTART(node);
+
+    munmap(map, ((uint8_t*)node - map) + GET_BLOCKSIZE(node));
+}
+
+/**
+ * \brief Resizes mapping of the block, moving it if it can't grow in place.
+ * Payload keeps its offset in the page, so alignment up to page is kept.
+ *
+ * @return void* new address of payload or NULL if mapping can't be
+ * resized, block is left untouched then
+ */
+void *_mmapResize(void *mem, size_t size)
+{
+    t_MemNode *node = (t_MemNode*) OFFSET(mem, -SSIZE);
+    uint8_t *map = MAPSTART(node);
+    size_t page = _pageSize(), head = (uint8_t*)node - map;
+    size_t len = head + GET_BLOCKSIZE(node), newlen;
+
+    if (size > NODE_MAXSIZE - head - SSIZE - page)
+        return NULL;
+    newlen = ALIGN_UP(head + SSIZE + size, page);
+    if (newlen == len)
+        return mem;
+
+#ifdef MREMAP_MAYMOVE
+    map = mremap(map, len, newlen, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED)
+        return NULL;
+#else
+    if (newlen < len)
+        munmap(map + newlen, len - newlen);
+    else
+    {
+        uint8_t *newmap = mmap(NULL, newlen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (newmap == MAP_FAILED)
+            return NULL;
+        _amemcopy(newmap, map, len);
+        munmap(map, len);
+        map = newmap;
+    }
+#endif
+
+    node = (t_MemNode*)(map + head);
+    SET_BLOCKSIZE(node, newlen - head);
+    return (void*)OFFSET(node, SSIZE);
+}
+
+/**
+ * \brief Gives whole pages inside free blocks of the heap back to the
+ * system with madvise(MADV_DONTNEED). Node and free list links at the
+ * start of every block are kept, pages are mapped again, zeroed, when
+ * block is used. Heap lock has to be taken.
+ *
+ * @return size_t number of bytes released
+ */
+size_t _mmapTrim(t_Heap *heap)
+{
+    size_t page = _pageSize(), released = 0;
+    uintptr_t start, end;
+
+    for (t_MemNode *node = heap->firstblock; node; node = GET_NEXT(node))
+    {
+        if (!BLOCK_ISFREE(node))
+            continue;
+        start = ALIGN_UP(OFFSET(node, SSIZE + sizeof(t_FreeLinks)), page);
+        end = OFFSET(node, GET_BLOCKSIZE(node)) & ~(uintptr_t)(page - 1);
+        if (end > start && !madvise((void*)start, end - start, MADV_DONTNEED))
+            released += end - start;
+    }
+    return released;
+}
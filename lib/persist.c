@@ -0,0 +1,406 @@
+/*
+ * persist.c
+ * Persistent heap, used when ALLOCATOR_PERSIST is defined.
+ * Heap lies in file or shared memory, every process using it maps it
+ * at address of its own. Compact nodes link blocks by distance and
+ * header in front of blocks keeps only offsets from itself, so nothing
+ * in mapped memory depends on where it lies. t_Heap is made from the
+ * header in every process. Processes share robust mutex kept in header,
+ * heap left by process which died in the middle of operation is
+ * recovered from links of its nodes.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+#include <allocator_lib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(ALLOCATOR_ENGINE_TLSF) || defined(ALLOCATOR_ENGINE_BUDDY) || defined(ALLOCATOR_FREE_LIST)
+#error "ALLOCATOR_PERSIST works only with list engine, without ALLOCATOR_FREE_LIST"
+#endif
+#if defined(ALLOCATOR_SLAB) || defined(ALLOCATOR_POOLS) || defined(ALLOCATOR_MMAP) || defined(ALLOCATOR_REMOTE_FREE)
+#error "ALLOCATOR_PERSIST can't be used with ALLOCATOR_SLAB, ALLOCATOR_POOLS, ALLOCATOR_MMAP or ALLOCATOR_REMOTE_FREE"
+#endif
+
+#define PERSIST_MAGIC 0x4C4D4159u
+#define PERSIST_VERSION 1
+
+/*
+ * Layout of nodes, heap made by build with other layout is refused.
+ */
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+#define PERSIST_CONFIG ((uint32_t)(SSIZE | ALLOCATOR_ALIGNMENT << 8 | 1u << 24))
+#else
+#define PERSIST_CONFIG ((uint32_t)(SSIZE | ALLOCATOR_ALIGNMENT << 8))
+#endif
+
+#define HEADERSIZE ALIGN_UP(sizeof(t_Persist), ALLOCATOR_ALIGNMENT)
+
+/*! \struct t_PersistHandle
+ * \brief Heap state of the process, descriptor and size of mapped file.
+ */
+typedef struct _persist_handle
+{
+    t_Heap heap;
+    int fd;
+    size_t mapsize;
+} t_PersistHandle;
+
+/**
+ * \brief FNV-1a hash of header fields between magic and checksum, which never change.
+ */
+static uint32_t _checksum(t_Persist *persist)
+{
+    const uint8_t *byte = (const uint8_t*)persist;
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = offsetof(t_Persist, version); i < offsetof(t_Persist, checksum); i++)
+        hash = (hash ^ byte[i]) * 16777619u;
+    return hash;
+}
+
+/**
+ * \brief Makes mutex of header, shared by processes and robust, so
+ * it's released by the system when its owner dies.
+ */
+static int _lockInit(t_Persist *persist)
+{
+    pthread_mutexattr_t attr;
+    int err;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    err = pthread_mutex_init(&persist->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return err;
+}
+
+/**
+ * \brief Tells if next can follow node, it lies after node, in the heap and is aligned.
+ */
+static int _follows(t_Heap *heap, t_MemNode *node, t_MemNode *next)
+{
+    return ((uint8_t*)next >= (uint8_t*)node + SSIZE &&
+            (uint8_t*)next + SSIZE <= heap->start + heap->size &&
+            !((uintptr_t)next % ALLOCATOR_ALIGNMENT));
+}
+
+/**
+ * \brief Rebuilds list of blocks of heap left in the middle of operation.
+ *
+ * Next block always lies right after the node, engine writes link of
+ * block before its size, so link is trusted and size is set to distance
+ * to the next block. Block split or joined halfway ends as it was before
+ * or after the operation. Link which doesn't point further into the heap
+ * is taken from size, or block spans to the end of the heap. Adjacent
+ * free blocks are joined. Block taken by process which died before it
+ * got its address stays used, payload of block moved down by realloc
+ * may be lost. Heap lock has to be taken.
+ */
+static void _recover(t_Heap *heap)
+{
+    t_MemNode *node = heap->firstblock, *next, *prev = NULL;
+    uint8_t *end = heap->start + heap->size;
+    size_t size;
+
+    while (node)
+    {
+        next = GET_NEXT(node);
+        if (next && !_follows(heap, node, next))
+        {
+            next = (t_MemNode*)OFFSET(node, GET_BLOCKSIZE(node));
+            if (!_follows(heap, node, next))
+                next = NULL;
+        }
+        size = (next ? (uint8_t*)next : end) - (uint8_t*)node;
+
+        SET_NEXT(node, next);
+        if (BLOCK_ISUSED(node))
+        {
+            SET_BLOCKUSED(node, size);
+            CANARY_SET(node);
+        }
+        else
+            SET_BLOCKFREE(node, size);
+
+        if (prev && BLOCK_ISFREE(prev) && BLOCK_ISFREE(node))
+        {
+            SET_NEXT(prev, next);
+            SET_BLOCKFREE(prev, GET_BLOCKSIZE(prev) + size);
+        }
+        else
+        {
+#ifdef ALLOCATOR_BOUNDARY_TAGS
+            SET_PREV(node, prev);
+#endif
+            prev = node;
+        }
+        node = next;
+    }
+}
+
+/**
+ * \brief Takes lock of persistent heap. When process holding it died,
+ * heap is recovered before lock is marked consistent again.
+ */
+void _persistLock(t_Heap *heap)
+{
+    t_Persist *persist = heap->persist;
+
+    if (pthread_mutex_lock(&persist->lock) == EOWNERDEAD)
+    {
+        _recover(heap);
+        pthread_mutex_consistent(&persist->lock);
+    }
+    persist->busy = 1;
+}
+
+/**
+ * \brief Releases lock of persistent heap.
+ */
+void _persistUnlock(t_Heap *heap)
+{
+    heap->persist->busy = 0;
+    pthread_mutex_unlock(&heap->persist->lock);
+}
+
+/**
+ * \brief Tells if header describes heap made by this build, fitting in size bytes.
+ */
+static int _isValid(t_Persist *persist, size_t size)
+{
+    return (persist->magic == PERSIST_MAGIC &&
+            persist->version == PERSIST_VERSION &&
+            persist->config == PERSIST_CONFIG &&
+            persist->checksum == _checksum(persist) &&
+            persist->size <= size &&
+            persist->size >= HEADERSIZE + MINBLOCK);
+}
+
+/**
+ * \brief Makes handle of heap in mapped memory.
+ *
+ * Zeroed memory is made new heap if reset is set, magic is written
+ * last, so heap which wasn't made completely is made again. Otherwise
+ * header has to be valid. With reset lock is made again, as its
+ * state is lost when all processes exit, and heap left busy is recovered.
+ *
+ * @return t_Heap* handle or NULL if memory doesn't hold valid heap
+ */
+static t_Heap *_attach(void *base, size_t size, int reset)
+{
+    t_Persist *persist = (t_Persist*)base;
+    t_PersistHandle *handle;
+    t_Heap *heap;
+    int fresh;
+
+    if (!base || (uintptr_t)base % ALLOCATOR_ALIGNMENT || size < HEADERSIZE + MINBLOCK)
+        return NULL;
+
+    fresh = (reset && persist->magic == 0);
+    if (!fresh && !_isValid(persist, size))
+        return NULL;
+
+    handle = mmap(NULL, sizeof(t_PersistHandle), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (handle == MAP_FAILED)
+        return NULL;
+    heap = &handle->heap;
+    handle->fd = -1;
+    handle->mapsize = size;
+
+    if (fresh)
+    {
+        persist->version = PERSIST_VERSION;
+        persist->size = size;
+        persist->config = PERSIST_CONFIG;
+        persist->root = 0;
+        persist->busy = 0;
+    }
+
+    heap->persist = persist;
+    heap->start = (uint8_t*)OFFSET(persist, HEADERSIZE);
+    heap->size = persist->size - HEADERSIZE;
+    if (heap->size > NODE_MAXSIZE)
+        heap->size = NODE_MAXSIZE;
+    heap->size &= ~(size_t)(ALLOCATOR_ALIGNMENT - 1);
+    pthread_mutex_init(&heap->lock, NULL);
+
+    if (reset && _lockInit(persist))
+    {
+        munmap(handle, sizeof(t_PersistHandle));
+        return NULL;
+    }
+
+    if (fresh)
+    {
+        heap->firstblock = _engineInit(heap);
+        persist->checksum = _checksum(persist);
+        __atomic_store_n(&persist->magic, PERSIST_MAGIC, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        heap->firstblock = (t_MemNode*)heap->start;
+        if (reset && persist->busy)
+        {
+            _recover(heap);
+            persist->busy = 0;
+        }
+    }
+    STAT_INIT(heap);
+    return heap;
+}
+
+/**
+ * \brief Uses memory mapped by caller as persistent heap.
+ *
+ * Memory has to be aligned to ALLOCATOR_ALIGNMENT. Zeroed memory is
+ * made new heap, if reset is set. Reset has to be set only by process
+ * which knows no other one uses the heap.
+ *
+ * @param void* start of mapped memory
+ * @param size_t size of mapped memory
+ * @param int no other process uses the heap
+ * @return t_Heap* heap handle or NULL if memory doesn't hold valid heap
+ */
+t_Heap *_apersistattach(void *base, size_t size, int reset)
+{
+    return _attach(base, size, reset);
+}
+
+/**
+ * \brief Maps whole file and attaches heap in it.
+ */
+static t_Heap *_mapFile(int fd, size_t size, int reset)
+{
+    struct stat st;
+    t_Heap *heap;
+    void *base;
+
+    if (fstat(fd, &st))
+        return NULL;
+    if (st.st_size == 0 && reset)
+    {
+        if (ftruncate(fd, (off_t)size))
+            return NULL;
+        st.st_size = (off_t)size;
+    }
+
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    heap = _attach(base, (size_t)st.st_size, reset);
+    if (!heap)
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    ((t_PersistHandle*)heap)->fd = fd;
+    return heap;
+}
+
+/**
+ * \brief Maps file as persistent heap.
+ *
+ * File which doesn't exist or is empty is made size bytes large, size
+ * of existing one is kept. File in /dev/shm is shared memory which
+ * survives processes, but not restart of the system. Every process
+ * holds read lock on first byte of the file while heap is open, the one
+ * which gets write lock is the only user of the heap, it makes the
+ * heap lock again and recovers the heap. Write lock is changed to read
+ * lock at once, when heap is ready. Locks of file are kept per process,
+ * so process opens the same heap only once.
+ *
+ * @param const char* path of the file
+ * @param size_t size of new file
+ * @return t_Heap* heap handle or NULL if file can't be mapped or
+ * doesn't hold valid heap
+ */
+t_Heap *_apersistopen(const char *path, size_t size)
+{
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1 };
+    t_Heap *heap = NULL;
+    int fd, reset;
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return NULL;
+
+    reset = (fcntl(fd, F_SETLK, &lock) == 0);
+    lock.l_type = F_RDLCK;
+    if (reset || fcntl(fd, F_SETLKW, &lock) == 0)
+        heap = _mapFile(fd, size, reset);
+    if (heap && reset)
+        fcntl(fd, F_SETLK, &lock);
+
+    if (!heap)
+        close(fd);
+    return heap;
+}
+
+/**
+ * \brief Drops handle of persistent heap, unmaps heap opened by
+ * _apersistopen() and releases lock of its file. Blocks and root stay
+ * in the heap, thread caches don't hold blocks of persistent heap.
+ */
+void _apersistclose(t_Heap *heap)
+{
+    t_PersistHandle *handle = (t_PersistHandle*)heap;
+
+    if (handle->fd >= 0)
+    {
+        munmap(heap->persist, handle->mapsize);
+        close(handle->fd);
+    }
+    pthread_mutex_destroy(&heap->lock);
+    munmap(handle, sizeof(t_PersistHandle));
+}
+
+/**
+ * \brief Writes heap opened by _apersistopen() to its file. Memory
+ * attached by _apersistattach() is synchronized by caller.
+ *
+ * @return int 0 on success, -1 if write failed
+ */
+int _apersistsync(t_Heap *heap)
+{
+    t_PersistHandle *handle = (t_PersistHandle*)heap;
+
+    if (handle->fd < 0)
+        return 0;
+    return msync(heap->persist, handle->mapsize, MS_SYNC);
+}
+
+/**
+ * \brief Returns root object of the heap, kept as offset from header.
+ */
+void *_apersistroot(t_Heap *heap)
+{
+    uint64_t root;
+
+    HEAP_LOCK(heap);
+    root = heap->persist->root;
+    HEAP_UNLOCK(heap);
+    return (root ? (void*)OFFSET(heap->persist, root) : NULL);
+}
+
+/**
+ * \brief Sets root object of the heap, NULL clears it.
+ */
+void _apersistsetroot(t_Heap *heap, void *ptr)
+{
+    HEAP_LOCK(heap);
+    heap->persist->root = (ptr ? (uint64_t)((uintptr_t)ptr - (uintptr_t)heap->persist) : 0);
+    HEAP_UNLOCK(heap);
+}
@@ -0,0 +1,255 @@
+/*
+ * preload.c
+ * Replacement of malloc() family of C library, built in libyamal.so
+ * (make preload) and loaded in front of C library with LD_PRELOAD:
+ *
+ *   LD_PRELOAD=./libyamal.so YAMAL_HEAP_SIZE=4g program
+ *
+ * Default heap is anonymous mapping made on first allocation, before
+ * any other thread can allocate. Its size is taken from environment,
+ * pages are given by the system when they are touched, so large heap
+ * costs only address space. Environment:
+ *
+ *   YAMAL_HEAP_SIZE    bytes of the heap, k, m or g suffix, default 1g
+ *   YAMAL_HEAP_POLICY  best, first, next or address, see _asetpolicy()
+ *   YAMAL_STATS        print heap counters at exit (ALLOCATOR_STATS)
+ *
+ * Zero size allocation gets smallest block of its own, as in glibc.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+#include <allocator_lib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef ALLOCATOR_THREADSAFE
+#error "libyamal.so needs ALLOCATOR_THREADSAFE"
+#endif
+
+/*! \def PRELOAD_HEAP_SIZE
+ * \brief Size of the heap if YAMAL_HEAP_SIZE isn't set.
+ */
+#ifndef PRELOAD_HEAP_SIZE
+#define PRELOAD_HEAP_SIZE ((size_t)1024 * 1024 * 1024)
+#endif
+
+uint8_t *_a_heapstart;
+size_t _a_heapsize;
+
+static pthread_once_t heaponce = PTHREAD_ONCE_INIT;
+
+//names of t_HeapPolicy values, in their order
+static const char *policies[] = { "best", "first", "next", "address" };
+
+/**
+ * \brief Reads size from environment, with k, m or g suffix.
+ *
+ * @return size_t size or def if variable isn't set or is 0
+ */
+static size_t _envSize(const char *name, size_t def)
+{
+    const char *val = getenv(name);
+    unsigned long long size;
+    char *end;
+
+    if (!val)
+        return def;
+
+    size = strtoull(val, &end, 0);
+    switch (*end)
+    {
+    case 'g':
+    case 'G':
+        size <<= 10;
+        //fall through
+    case 'm':
+    case 'M':
+        size <<= 10;
+        //fall through
+    case 'k':
+    case 'K':
+        size <<= 10;
+        break;
+    }
+    return (size ? (size_t)size : def);
+}
+
+/**
+ * \brief Maps the heap and builds its engine blocks, runs once.
+ * Nothing here may allocate, calling thread holds the once flag.
+ */
+static void _preloadMap(void)
+{
+    size_t size = _envSize("YAMAL_HEAP_SIZE", PRELOAD_HEAP_SIZE);
+    const char *name = getenv("YAMAL_HEAP_POLICY");
+    void *map;
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map != MAP_FAILED)
+    {
+        _a_heapstart = map;
+        _a_heapsize = size;
+    }
+    _amalloc(0);
+
+    for (size_t policy = 0; name && policy < sizeof(policies) / sizeof(policies[0]); policy++)
+        if (!strcmp(name, policies[policy]))
+            _asetpolicy((t_HeapPolicy)policy);
+}
+
+static inline void _preloadStart(void)
+{
+    pthread_once(&heaponce, _preloadMap);
+}
+
+#ifdef ALLOCATOR_STATS
+/**
+ * \brief Prints counters of the heap at exit if YAMAL_STATS is set.
+ */
+static void __attribute__((destructor)) _preloadStats(void)
+{
+    t_HeapStats stats;
+
+    if (!getenv("YAMAL_STATS"))
+        return;
+
+    _agetstats(&stats);
+    fprintf(stderr, "yamal: heap %zu bytes, used %zu bytes in %zu blocks, peak %zu bytes\n"
+                    "yamal: free %zu bytes, largest %zu bytes\n"
+                    "yamal: malloc %zu, free %zu, realloc %zu, failed %zu\n",
+            stats.size, stats.used, stats.usedblocks, stats.peak,
+            stats.free, stats.largest,
+            stats.mallocs, stats.frees, stats.reallocs, stats.failed);
+}
+#endif
+
+/**
+ * \brief Maps the heap at load and makes fork() safe. Registration
+ * may allocate, so it's done here, not in _preloadMap().
+ */
+static void __attribute__((constructor)) _preloadInit(void)
+{
+    _preloadStart();
+    pthread_atfork(_aforklock, _aforkunlock, _aforkunlock);
+}
+
+void *malloc(size_t size)
+{
+    void *ptr;
+
+    _preloadStart();
+    ptr = _amalloc(size ? size : 1);
+    if (!ptr)
+        errno = ENOMEM;
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    _afree(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *newptr;
+
+    _preloadStart();
+    newptr = _arealloc(ptr, size);
+    if (!newptr && size)
+        errno = ENOMEM;
+    return newptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    _preloadStart();
+    ptr = (nmemb && size ? _acalloc(nmemb, size) : _acalloc(1, 1));
+    if (!ptr)
+        errno = ENOMEM;
+    return ptr;
+}
+
+/**
+ * \brief Aligned allocation, alignment up to ALLOCATOR_ALIGNMENT is given
+ * by every block, so it's plain allocation.
+ *
+ * @return void* address of memory or NULL, errno is EINVAL if alignment
+ * isn't power of two, ENOMEM if there is no memory
+ */
+static void *_preloadAlign(size_t alignment, size_t size)
+{
+    void *ptr;
+
+    if (!alignment || (alignment & (alignment - 1)))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (alignment <= ALLOCATOR_ALIGNMENT)
+        return malloc(size);
+
+    _preloadStart();
+    ptr = _amemalign(alignment, size ? size : 1);
+    if (!ptr)
+        errno = ENOMEM;
+    return ptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *ptr;
+
+    if (!alignment || (alignment & (alignment - 1)) || alignment % sizeof(void*))
+        return EINVAL;
+    ptr = _preloadAlign(alignment, size);
+    if (!ptr)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return _preloadAlign(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    return _preloadAlign(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+    return _preloadAlign((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (size > SIZE_MAX - page)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return _preloadAlign(page, ALIGN_UP(size, page));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    return _amalloc_usable_size(ptr);
+}
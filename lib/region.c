@@ -0,0 +1,112 @@
+/*
+ * region.c
+ * Regions, used when ALLOCATOR_REGION is defined.
+ * Region is one block of the heap, which state is kept at its start.
+ * Rest of the block is given out by moving top pointer up, objects
+ * have no node and aren't freed one by one. Mark is just offset of the
+ * top, rolling back to it or resetting whole region moves the top down,
+ * so teardown of everything allocated takes constant time.
+ * Region isn't guarded by any lock, it's meant to be used by one thread.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+#include <allocator_lib.h>
+
+struct _region
+{
+    t_Heap *heap;
+    uint8_t *top;
+    uint8_t *end;
+};
+
+#define RSIZE ALIGN_UP(sizeof(t_Region), ALLOCATOR_ALIGNMENT)
+#define RSTART(REGION) ((uint8_t*)OFFSET(REGION, RSIZE))
+
+/**
+ * \brief Makes region of size bytes in single block of the heap.
+ *
+ * @param t_Heap* heap to allocate from, NULL for default heap
+ * @param size_t bytes available in region
+ * @return t_Region* region or NULL if there is no memory for it
+ */
+t_Region *_aregioninit(t_Heap *heap, size_t size)
+{
+    t_Region *region;
+
+    if (size > SIZE_MAX - RSIZE)
+        return NULL;
+
+    region = (heap ? _ahmalloc(heap, RSIZE + size) : _amalloc(RSIZE + size));
+    if (!region)
+        return NULL;
+
+    region->heap = heap;
+    region->top = RSTART(region);
+    region->end = region->top + size;
+    return region;
+}
+
+/**
+ * \brief Takes memory from region.
+ *
+ * @param t_Region* region
+ * @param size_t size of memory needed, rounded up to ALLOCATOR_ALIGNMENT
+ * @return void* address of memory or NULL if region is full
+ */
+void *_aregionalloc(t_Region *region, size_t size)
+{
+    uint8_t *ptr = region->top;
+    size_t avail = region->end - ptr;
+
+    if (size > avail || ALIGN_UP(size, ALLOCATOR_ALIGNMENT) > avail)
+        return NULL;
+
+    region->top = ptr + ALIGN_UP(size, ALLOCATOR_ALIGNMENT);
+    return ptr;
+}
+
+/**
+ * \brief Returns offset of region top, which can be rolled back to.
+ */
+size_t _aregionmark(t_Region *region)
+{
+    return region->top - RSTART(region);
+}
+
+/**
+ * \brief Moves region top back to mark. Marks above current top,
+ * left by earlier rollback, are ignored.
+ */
+void _aregionrollback(t_Region *region, size_t mark)
+{
+    if (mark < _aregionmark(region))
+        region->top = RSTART(region) + mark;
+}
+
+/**
+ * \brief Moves region top back to its start.
+ */
+void _aregionreset(t_Region *region)
+{
+    region->top = RSTART(region);
+}
+
+/**
+ * \brief Frees block of region.
+ */
+void _aregionfree(t_Region *region)
+{
+    if (!region)
+        return;
+
+    if (region->heap)
+        _ahfree(region->heap, (uintptr_t*)region);
+    else
+        _afree((uintptr_t*)region);
+}
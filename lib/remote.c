@@ -0,0 +1,79 @@
+/*
+ * remote.c
+ * Remote frees, used when ALLOCATOR_REMOTE_FREE is defined.
+ * Heap made by _aheapinit() may have owner thread. Block freed by any
+ * other thread is pushed on stack of the heap with single compare and
+ * swap, linked through its payload, heap lock isn't taken. Owner takes
+ * whole stack with one atomic exchange on its next allocation and gives
+ * blocks back to the engine under one lock. Stack is never popped block
+ * by block, so there's no ABA problem and any thread can take it, which
+ * is done when heap runs out of memory.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+#include <allocator_lib.h>
+
+//address of this variable tells threads apart
+static __thread uint8_t self;
+
+/**
+ * \brief Makes calling thread owner of heap.
+ */
+void _ahsetowner(t_Heap *heap)
+{
+    __atomic_store_n(&heap->remote.owner, (void*)&self, __ATOMIC_RELAXED);
+#ifdef ALLOCATOR_POOLS
+    for (heap = __atomic_load_n(&heap->pool, __ATOMIC_ACQUIRE); heap;
+         heap = __atomic_load_n(&heap->pool, __ATOMIC_ACQUIRE))
+        __atomic_store_n(&heap->remote.owner, (void*)&self, __ATOMIC_RELAXED);
+#endif
+}
+
+/**
+ * \brief Pushes block on remote stack if heap is owned by other thread.
+ * Heap lock isn't taken, only cache line of the stack is written.
+ *
+ * @param t_Heap* heap block was allocated from
+ * @param uintptr_t* payload of the block
+ * @return int 1 if block was pushed, 0 otherwise
+ */
+int _remoteFree(t_Heap *heap, uintptr_t *mem)
+{
+    void *owner = __atomic_load_n(&heap->remote.owner, __ATOMIC_RELAXED);
+    uintptr_t *head;
+
+    //payload of first block, given for zero size, may be in use or free
+    if (!owner || owner == (void*)&self || mem == heap->remote.zero)
+        return 0;
+
+    head = __atomic_load_n(&heap->remote.head, __ATOMIC_RELAXED);
+    do
+        REMOTE_NEXT(mem) = head;
+    while (!__atomic_compare_exchange_n(&heap->remote.head, &head, mem, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return 1;
+}
+
+/**
+ * \brief Takes all blocks pushed on remote stack.
+ *
+ * @param t_Heap* heap
+ * @param int take stack even if calling thread isn't owner of the heap
+ * @return uintptr_t* first block of taken stack or NULL
+ */
+uintptr_t *_remoteTake(t_Heap *heap, int any)
+{
+    if (!any && __atomic_load_n(&heap->remote.owner, __ATOMIC_RELAXED) != (void*)&self)
+        return NULL;
+
+    //plain load first, so empty stack isn't written to
+    if (!__atomic_load_n(&heap->remote.head, __ATOMIC_RELAXED))
+        return NULL;
+    return __atomic_exchange_n(&heap->remote.head, NULL, __ATOMIC_ACQUIRE);
+}
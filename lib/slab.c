@@ -0,0 +1,335 @@
+/*
+ * slab.c
+ * Slab front-end for small objects, used when ALLOCATOR_SLAB is defined.
+ * On first small allocation every heap carves one arena out of itself
+ * and divides it in pages of ALLOCATOR_SLAB_PAGE bytes. Page is given
+ * to one of size classes (ALLOCATOR_SLAB_SIZES) and cut in slots of that
+ * size. Slots have no node, free slots are linked through their
+ * payload, so allocation and free are just pop and push of list head.
+ * Object belongs to slab if its address lies in arena, its page
+ * descriptor is found by dividing its offset by page size.
+ * Completely free pages return to the arena and can be taken by
+ * any other class.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+#include <allocator_lib.h>
+
+#ifdef ALLOCATOR_USEREPORT
+#include <stdio.h>
+#endif
+
+#define NOPAGE UINT32_MAX
+#define SLOTNEXT(SLOT) (*(void**)(SLOT))
+
+static const size_t slabsizes[] = { ALLOCATOR_SLAB_SIZES };
+#define SLAB_CLASSES (sizeof(slabsizes) / sizeof(slabsizes[0]))
+
+#ifdef ALLOCATOR_CANARY
+/*
+ * Slots have no node to keep canary in, page keeps bitmap of its used
+ * slots instead, so slot freed twice is found. Page holds at most as
+ * many slots as there are slots of the smallest class.
+ */
+#define SLAB_FIRST(...) SLAB_FIRST_(__VA_ARGS__, 0)
+#define SLAB_FIRST_(SIZE, ...) (SIZE)
+#define SLAB_MAPWORDS ((ALLOCATOR_SLAB_PAGE / SLAB_FIRST(ALLOCATOR_SLAB_SIZES) + 31) / 32)
+#define SLOTBIT(SLOT) (1u << ((SLOT) % 32))
+#endif
+
+/*! \struct t_SlabPage
+ * \brief Descriptor of one arena page.
+ */
+typedef struct _slab_page
+{
+    void *freeslot;
+    uint16_t cls;
+    uint16_t used;
+    uint16_t carved;
+    uint32_t next;
+    uint32_t prev;
+#ifdef ALLOCATOR_CANARY
+    uint32_t usedmap[SLAB_MAPWORDS];
+#endif
+} t_SlabPage;
+
+/*! \struct t_Slab
+ * \brief Slab state, kept at the start of the arena, followed by page
+ * descriptors and pages.
+ */
+struct _slab
+{
+    uint8_t *pages;
+    uint32_t npages;
+    uint32_t freepages;
+    uint32_t partial[SLAB_CLASSES];
+    t_SlabPage desc[];
+};
+
+/**
+ * \brief Index of size class which slots can hold size bytes, or -1.
+ */
+static int _slabClass(size_t size)
+{
+    for (unsigned int cls = 0; cls < SLAB_CLASSES; cls++)
+        if (size <= slabsizes[cls])
+            return cls;
+    return -1;
+}
+
+/**
+ * \brief Removes page from the head of the list.
+ */
+static uint32_t _popPage(t_Slab *slab, uint32_t *head)
+{
+    uint32_t idx = *head;
+
+    *head = slab->desc[idx].next;
+    if (*head != NOPAGE)
+        slab->desc[*head].prev = NOPAGE;
+    return idx;
+}
+
+/**
+ * \brief Puts page at the head of the list.
+ */
+static void _pushPage(t_Slab *slab, uint32_t *head, uint32_t idx)
+{
+    slab->desc[idx].prev = NOPAGE;
+    slab->desc[idx].next = *head;
+    if (*head != NOPAGE)
+        slab->desc[*head].prev = idx;
+    *head = idx;
+}
+
+/**
+ * \brief Unlinks page from any place of the list.
+ */
+static void _unlinkPage(t_Slab *slab, uint32_t *head, uint32_t idx)
+{
+    t_SlabPage *page = &slab->desc[idx];
+
+    if (page->prev != NOPAGE)
+        slab->desc[page->prev].next = page->next;
+    else
+        *head = page->next;
+    if (page->next != NOPAGE)
+        slab->desc[page->next].prev = page->prev;
+}
+
+/**
+ * \brief Carves arena of ALLOCATOR_SLAB_ARENA bytes (at most quarter of
+ * the heap) out of the heap. Heap lock has to be taken.
+ *
+ * @return t_Slab* slab state or NULL if heap is too small
+ */
+static t_Slab *_slabInit(t_Heap *heap)
+{
+    size_t arena = ALLOCATOR_SLAB_ARENA, head;
+    uint32_t npages;
+    t_MemNode *node;
+    t_Slab *slab;
+
+    heap->noslab = 1;
+
+    if (arena > heap->size / 4)
+        arena = heap->size / 4;
+
+    head = sizeof(t_Slab) + sizeof(t_SlabPage);
+    if (arena < head + ALLOCATOR_SLAB_PAGE)
+        return NULL;
+    npages = (arena - sizeof(t_Slab)) / (ALLOCATOR_SLAB_PAGE + sizeof(t_SlabPage));
+
+    head = sizeof(t_Slab) + npages * sizeof(t_SlabPage) + SSIZE;
+    head = ALIGN(head);
+    node = _engineAlloc(heap, head + (size_t)npages * ALLOCATOR_SLAB_PAGE);
+    if (!node)
+        return NULL;
+    CANARY_SET(node);
+    STAT_ENGINE(heap, GET_BLOCKSIZE(node));
+
+    slab = (t_Slab*)OFFSET(node, SSIZE);
+    slab->pages = (uint8_t*)OFFSET(node, head);
+    slab->npages = npages;
+    slab->freepages = NOPAGE;
+    for (unsigned int cls = 0; cls < SLAB_CLASSES; cls++)
+        slab->partial[cls] = NOPAGE;
+    for (uint32_t idx = npages; idx-- > 0;)
+    {
+#ifdef ALLOCATOR_CANARY
+        for (unsigned int i = 0; i < SLAB_MAPWORDS; i++)
+            slab->desc[idx].usedmap[i] = 0;
+#endif
+        _pushPage(slab, &slab->freepages, idx);
+    }
+
+    heap->noslab = 0;
+    return slab;
+}
+
+/**
+ * \brief Index of arena page holding ptr, or NOPAGE if ptr isn't slab object.
+ */
+static uint32_t _slabPage(t_Slab *slab, void *ptr)
+{
+    uintptr_t offset = (uintptr_t)ptr - (uintptr_t)slab->pages;
+
+    if ((uintptr_t)ptr < (uintptr_t)slab->pages ||
+        offset >= (uintptr_t)slab->npages * ALLOCATOR_SLAB_PAGE)
+        return NOPAGE;
+    return offset / ALLOCATOR_SLAB_PAGE;
+}
+
+#ifdef ALLOCATOR_CANARY
+/**
+ * \brief Number of slot holding ptr in its page.
+ */
+static size_t _slabSlot(t_Slab *slab, uint32_t idx, void *ptr)
+{
+    size_t offset = (uint8_t*)ptr - slab->pages - (size_t)idx * ALLOCATOR_SLAB_PAGE;
+
+    return offset / slabsizes[slab->desc[idx].cls];
+}
+#endif
+
+/**
+ * \brief Allocates slot of smallest class able to hold size bytes.
+ * Heap lock has to be taken.
+ *
+ * @return void* address of slot or NULL if size isn't served by slab
+ * or slab is out of pages
+ */
+void *_slabAlloc(t_Heap *heap, size_t size)
+{
+    int cls = _slabClass(size);
+    t_Slab *slab = heap->slab;
+    t_SlabPage *page;
+    uint32_t idx;
+    void *slot;
+
+    if (cls < 0 || heap->noslab)
+        return NULL;
+
+    if (!slab)
+    {
+        slab = _slabInit(heap);
+        if (!slab)
+            return NULL;
+        __atomic_store_n(&heap->slab, slab, __ATOMIC_RELEASE);
+    }
+
+    idx = slab->partial[cls];
+    if (idx == NOPAGE)
+    {
+        if (slab->freepages == NOPAGE)
+            return NULL;
+        idx = _popPage(slab, &slab->freepages);
+        page = &slab->desc[idx];
+        page->freeslot = NULL;
+        page->cls = cls;
+        page->used = 0;
+        page->carved = 0;
+        _pushPage(slab, &slab->partial[cls], idx);
+    }
+    page = &slab->desc[idx];
+
+    if (page->freeslot)
+    {
+        slot = page->freeslot;
+        page->freeslot = SLOTNEXT(slot);
+    }
+    else
+        slot = (void*)OFFSET(slab->pages, (size_t)idx * ALLOCATOR_SLAB_PAGE + page->carved++ * slabsizes[cls]);
+    page->used++;
+#ifdef ALLOCATOR_CANARY
+    size_t bit = _slabSlot(slab, idx, slot);
+
+    page->usedmap[bit / 32] |= SLOTBIT(bit);
+#endif
+
+    if (!page->freeslot &&
+        (size_t)(page->carved + 1) * slabsizes[cls] > ALLOCATOR_SLAB_PAGE)
+        _popPage(slab, &slab->partial[cls]);
+
+    return slot;
+}
+
+/**
+ * \brief Returns slot to its page, page which becomes empty is
+ * returned to the arena. Heap lock has to be taken.
+ * With ALLOCATOR_CANARY slot which isn't used is reported to
+ * _aheaperror() and left alone.
+ *
+ * @return size_t size of freed slot or 0 if ptr isn't slab object
+ * or slot was freed already
+ */
+size_t _slabFree(t_Heap *heap, void *ptr)
+{
+    t_Slab *slab = heap->slab;
+    t_SlabPage *page;
+    uint32_t idx;
+    uint8_t full;
+
+    if (!slab || (idx = _slabPage(slab, ptr)) == NOPAGE)
+        return 0;
+
+    page = &slab->desc[idx];
+#ifdef ALLOCATOR_CANARY
+    size_t bit = _slabSlot(slab, idx, ptr);
+
+    if (!(page->usedmap[bit / 32] & SLOTBIT(bit)))
+    {
+        _aheaperror(heap, ptr, HEAP_ERROR_FREED);
+        return 0;
+    }
+    page->usedmap[bit / 32] &= ~SLOTBIT(bit);
+#endif
+    full = (!page->freeslot &&
+            (size_t)(page->carved + 1) * slabsizes[page->cls] > ALLOCATOR_SLAB_PAGE);
+
+    SLOTNEXT(ptr) = page->freeslot;
+    page->freeslot = ptr;
+    page->used--;
+
+    if (page->used == 0)
+    {
+        if (!full)
+            _unlinkPage(slab, &slab->partial[page->cls], idx);
+        _pushPage(slab, &slab->freepages, idx);
+    }
+    else if (full)
+        _pushPage(slab, &slab->partial[page->cls], idx);
+
+    return slabsizes[page->cls];
+}
+
+/**
+ * \brief Tells if size may be served by slab. Doesn't need heap lock,
+ * heap which failed to carve its arena never tries again.
+ */
+int _slabServes(t_Heap *heap, size_t size)
+{
+    return (size <= slabsizes[SLAB_CLASSES - 1] && !__atomic_load_n(&heap->noslab, __ATOMIC_RELAXED));
+}
+
+/**
+ * \brief Size of slot holding ptr. Doesn't need heap lock, arena never
+ * moves once carved and class of page doesn't change while slot is used.
+ *
+ * @return size_t size of slot or 0 if ptr isn't slab object
+ */
+size_t _slabSize(t_Heap *heap, void *ptr)
+{
+    t_Slab *slab = __atomic_load_n(&heap->slab, __ATOMIC_ACQUIRE);
+    uint32_t idx;
+
+    if (!slab || (idx = _slabPage(slab, ptr)) == NOPAGE)
+        return 0;
+    return slabsizes[slab->desc[idx].cls];
+}
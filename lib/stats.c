@@ -0,0 +1,111 @@
+/*
+ * stats.c
+ * Heap counters, used when ALLOCATOR_STATS is defined.
+ * Counters are kept up to date by every operation, so reading them
+ * takes the same time on any heap. Bytes and blocks in use are counted
+ * where block is given to the program or taken back from it, free
+ * bytes and largest free block every time engine is called, under
+ * heap lock. In thread safe build counters are added atomically.
+ * Reader never takes the lock, every counter it gets is consistent,
+ * although they may come from moments few operations apart.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+#include <allocator_lib.h>
+
+#define LOAD(COUNTER) __atomic_load_n(&(COUNTER), __ATOMIC_RELAXED)
+#define STORE(COUNTER, VALUE) __atomic_store_n(&(COUNTER), (VALUE), __ATOMIC_RELAXED)
+
+/**
+ * \brief Largest payload which fits in largest free block.
+ */
+static size_t _largest(t_Heap *heap)
+{
+    size_t size = _engineLargest(heap);
+
+    return (size > SSIZE ? size - SSIZE : 0);
+}
+
+/**
+ * \brief Adds n to counter, atomically if heap can be used by many threads.
+ *
+ * @return size_t new value of counter
+ */
+size_t _statAdd(size_t *counter, size_t n)
+{
+#ifdef ALLOCATOR_THREADSAFE
+    return __atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+#else
+    STORE(*counter, *counter + n);
+    return *counter;
+#endif
+}
+
+/**
+ * \brief Counts call of public function, also as failed one if done is 0.
+ */
+void _statOp(t_Heap *heap, size_t *counter, int done)
+{
+    _statAdd(counter, 1);
+    if (!done)
+        _statAdd(&heap->stats.failed, 1);
+}
+
+/**
+ * \brief Sets counters of heap which engine was just initialized,
+ * all free blocks made by engine are the size of the heap.
+ */
+void _statInit(t_Heap *heap)
+{
+    t_HeapStats *stats = &heap->stats;
+    size_t free = 0;
+
+    *stats = (t_HeapStats){ 0 };
+    for (t_MemNode *node = heap->firstblock; node; node = GET_NEXT(node))
+        if (BLOCK_ISFREE(node))
+            free += GET_BLOCKSIZE(node);
+
+    STORE(stats->size, free);
+    STORE(stats->free, free);
+    STORE(stats->largest, _largest(heap));
+}
+
+/**
+ * \brief Adds size bytes and blocks to those in use, both may be
+ * negative. Peak is raised when more bytes are in use than ever before.
+ * Blocks of pools are counted in heap the pools were added to.
+ */
+void _statUse(t_Heap *heap, intptr_t size, int blocks)
+{
+    t_HeapStats *stats = &BASEHEAP(heap)->stats;
+    size_t used = _statAdd(&stats->used, (size_t)size), peak;
+
+    if (blocks)
+        _statAdd(&stats->usedblocks, (size_t)(intptr_t)blocks);
+
+    peak = LOAD(stats->peak);
+#ifdef ALLOCATOR_THREADSAFE
+    while (used > peak &&
+           !__atomic_compare_exchange_n(&stats->peak, &peak, used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+#else
+    if (used > peak)
+        STORE(stats->peak, used);
+#endif
+}
+
+/**
+ * \brief Engine took size bytes of free blocks, or gave them back if size
+ * is negative. Heap lock has to be taken.
+ */
+void _statEngine(t_Heap *heap, intptr_t size)
+{
+    STORE(heap->stats.free, heap->stats.free - size);
+    STORE(heap->stats.largest, _largest(heap));
+}
@@ -0,0 +1,195 @@
+/*
+ * tcache.c
+ * Thread safety layer, used when ALLOCATOR_THREADSAFE is defined.
+ * Every heap is guarded by its own lock, in front of default heap every
+ * thread keeps its own cache of small freed blocks divided in size classes.
+ * Blocks in cache stay marked as used for the engine, they are
+ * linked through their payload. Most allocations and frees are served
+ * from the cache, heap lock is taken only to refill or flush
+ * ALLOCATOR_TCACHE_BATCH blocks at once.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+#include <allocator_lib.h>
+#include <pthread.h>
+
+#ifdef ALLOCATOR_USEREPORT
+#include <stdio.h>
+#endif
+
+#define CACHENEXT(NODE) (*(t_MemNode**)OFFSET(NODE, SSIZE))
+
+typedef struct _tcache
+{
+    t_Heap *heap;
+    t_MemNode *lists[ALLOCATOR_TCACHE_CLASSES + 1];
+    uint16_t counts[ALLOCATOR_TCACHE_CLASSES + 1];
+    uint8_t registered;
+} t_TCache;
+
+static pthread_once_t keyonce = PTHREAD_ONCE_INIT;
+static pthread_key_t cachekey;
+static __thread t_TCache tcache;
+
+/**
+ * \brief Default heap lock, POSIX mutex kept in heap.
+ */
+void __attribute__((weak)) _alock(t_Heap *heap)
+{
+    pthread_mutex_lock(&heap->lock);
+}
+
+/**
+ * \brief Default heap unlock.
+ */
+void __attribute__((weak)) _aunlock(t_Heap *heap)
+{
+    pthread_mutex_unlock(&heap->lock);
+}
+
+static void _threadExit(void *cache)
+{
+    (void)cache;
+    _athreadflush();
+}
+
+static void _makeKey(void)
+{
+    pthread_key_create(&cachekey, _threadExit);
+}
+
+/**
+ * \brief Makes sure cache of calling thread is flushed when thread exits.
+ */
+static void _register(t_Heap *heap)
+{
+    tcache.heap = heap;
+    pthread_once(&keyonce, _makeKey);
+    pthread_setspecific(cachekey, &tcache);
+    tcache.registered = 1;
+}
+
+/**
+ * \brief Returns count most recently cached blocks of size class to the heap.
+ * Heap lock has to be taken.
+ */
+static void _flushClass(int cls, uint16_t count)
+{
+    t_MemNode *node;
+    size_t size;
+
+    while (count-- && tcache.lists[cls])
+    {
+        node = tcache.lists[cls];
+        tcache.lists[cls] = CACHENEXT(node);
+        tcache.counts[cls]--;
+        guard(tcache.heap, node);
+        size = GET_BLOCKSIZE(node);
+        CANARY_SET(node);
+        _engineFree(tcache.heap, node);
+        STAT_ENGINE(tcache.heap, -(intptr_t)size);
+    }
+}
+
+/**
+ * \brief Takes block from cache, refills size class with
+ * ALLOCATOR_TCACHE_BATCH blocks if it's empty.
+ *
+ * @param size_t size of payload requested
+ * @return t_MemNode* block or NULL if size isn't cached or heap is full
+ */
+t_MemNode *_tcacheAlloc(t_Heap *heap, size_t size)
+{
+    int cls;
+    size_t blocksize;
+    t_MemNode *node;
+
+    size = (size + ALLOCATOR_TCACHE_STEP - 1) / ALLOCATOR_TCACHE_STEP;
+    if (size > ALLOCATOR_TCACHE_CLASSES)
+        return NULL;
+    cls = size - 1;
+
+    if (!tcache.lists[cls])
+    {
+        if (!tcache.registered)
+            _register(heap);
+
+        blocksize = size * ALLOCATOR_TCACHE_STEP + SSIZE;
+        blocksize = ALIGN(blocksize);
+
+        HEAP_LOCK(heap);
+        for (int i = 0; i < ALLOCATOR_TCACHE_BATCH; i++)
+        {
+            node = _engineAlloc(heap, blocksize);
+            if (!node)
+                break;
+            STAT_ENGINE(heap, GET_BLOCKSIZE(node));
+            CANARY_CACHE(node);
+            CACHENEXT(node) = tcache.lists[cls];
+            tcache.lists[cls] = node;
+            tcache.counts[cls]++;
+        }
+        HEAP_UNLOCK(heap);
+
+        if (!tcache.lists[cls])
+            return NULL;
+    }
+
+    node = tcache.lists[cls];
+    tcache.lists[cls] = CACHENEXT(node);
+    tcache.counts[cls]--;
+    CANARY_SET(node);
+    return node;
+}
+
+/**
+ * \brief Puts block in cache of its size class. When class holds more
+ * than ALLOCATOR_TCACHE_COUNT blocks, ALLOCATOR_TCACHE_BATCH of them
+ * are returned to the heap.
+ *
+ * @return int 1 if block was cached, 0 otherwise
+ */
+int _tcacheFree(t_Heap *heap, t_MemNode *node)
+{
+    size_t cls = (GET_BLOCKSIZE(node) - SSIZE) / ALLOCATOR_TCACHE_STEP;
+
+    if (cls == 0 || cls > ALLOCATOR_TCACHE_CLASSES)
+        return 0;
+    cls--;
+
+    if (!tcache.registered)
+        _register(heap);
+
+    CANARY_CACHE(node);
+    CACHENEXT(node) = tcache.lists[cls];
+    tcache.lists[cls] = node;
+    tcache.counts[cls]++;
+
+    if (tcache.counts[cls] > ALLOCATOR_TCACHE_COUNT)
+    {
+        HEAP_LOCK(heap);
+        _flushClass(cls, ALLOCATOR_TCACHE_BATCH);
+        HEAP_UNLOCK(heap);
+    }
+    return 1;
+}
+
+/**
+ * \brief Returns all cached blocks of calling thread to the heap.
+ */
+void _athreadflush(void)
+{
+    if (!tcache.heap)
+        return;
+
+    HEAP_LOCK(tcache.heap);
+    for (int cls = 0; cls < ALLOCATOR_TCACHE_CLASSES; cls++)
+        _flushClass(cls, tcache.counts[cls]);
+    HEAP_UNLOCK(tcache.heap);
+}
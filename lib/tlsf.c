@@ -0,0 +1,414 @@
+/*
+ * tlsf.c
+ * Two-level segregated fit engine.
+ * Free blocks are kept in segregated lists, first level splits sizes
+ * in power of two ranges, second level splits each range linearly
+ * in 1 << ALLOCATOR_TLSF_SLBITS lists. Non empty lists are marked
+ * in bitmaps, so finding suitable block and consolidating block with
+ * its neighbours is done in constant time.
+ * Links of free lists are kept in unused space of free blocks,
+ * node keeps address of previous block to find left neighbour.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+#include <allocator_lib.h>
+#include <limits.h>
+#include <assert.h>
+
+#ifdef ALLOCATOR_USEREPORT
+#include <stdio.h>
+#endif
+
+/*
+ * Blocks smaller than SMALL_BLOCK are kept in first list,
+ * divided linearly in steps of ALLOCATOR_ALIGNMENT.
+ */
+#define SMALL_BLOCK ((size_t)1 << FL_SHIFT)
+
+/*
+ * Largest block engine can map, heap above it is trimmed.
+ */
+#if (SIZE_MAX >> ALLOCATOR_TLSF_FLMAX) > 0
+#define HEAPMAX (((size_t)1 << ALLOCATOR_TLSF_FLMAX) - ALLOCATOR_ALIGNMENT)
+#else
+#define HEAPMAX SIZE_MAX
+#endif
+
+#if FL_COUNT > 32 || ALLOCATOR_TLSF_SLBITS > 5
+#error "TLSF lookup bitmaps don't fit 32 bits, lower ALLOCATOR_TLSF_FLMAX or ALLOCATOR_TLSF_SLBITS"
+#endif
+
+/**
+ * \brief Index of most significant bit set, v must not be 0.
+ */
+static inline int _fls(size_t v)
+{
+    return (int)(sizeof(unsigned long long) * CHAR_BIT) - 1 - __builtin_clzll(v);
+}
+
+/**
+ * \brief Index of least significant bit set, v must not be 0.
+ */
+static inline int _ffs(uint32_t v)
+{
+    return __builtin_ctz(v);
+}
+
+/**
+ * \brief Computes list indexes for block of given size.
+ */
+static void _mapInsert(size_t size, int *fl, int *sl)
+{
+    if (size < SMALL_BLOCK)
+    {
+        *fl = 0;
+        *sl = size / (SMALL_BLOCK / SL_COUNT);
+    }
+    else
+    {
+        int f = _fls(size);
+        *sl = (int)(size >> (f - ALLOCATOR_TLSF_SLBITS)) ^ SL_COUNT;
+        *fl = f - (FL_SHIFT - 1);
+    }
+}
+
+/**
+ * \brief Computes indexes of first list which blocks all are at least size large.
+ */
+static void _mapSearch(size_t size, int *fl, int *sl)
+{
+    if (size >= SMALL_BLOCK)
+        size += ((size_t)1 << (_fls(size) - ALLOCATOR_TLSF_SLBITS)) - 1;
+    _mapInsert(size, fl, sl);
+}
+
+/**
+ * \brief Finds first non empty list at or above given indexes.
+ *
+ * @return t_MemNode* head of found list or NULL, indexes are updated
+ */
+static t_MemNode *_findSuitable(t_Engine *e, int *fl, int *sl)
+{
+    uint32_t map;
+
+    if (*fl >= FL_COUNT)
+        return NULL;
+
+    map = e->slbitmap[*fl] & (~0U << *sl);
+    if (!map)
+    {
+        map = (*fl + 1 < 32) ? e->flbitmap & (~0U << (*fl + 1)) : 0;
+        if (!map)
+            return NULL;
+
+        *fl = _ffs(map);
+        map = e->slbitmap[*fl];
+    }
+    *sl = _ffs(map);
+    return e->freelists[*fl][*sl];
+}
+
+/**
+ * \brief Unlinks free block from its list.
+ */
+static void _removeFree(t_Engine *e, t_MemNode *node)
+{
+    int fl, sl;
+    t_FreeLinks *links = FREELINKS(node);
+
+    _mapInsert(GET_BLOCKSIZE(node), &fl, &sl);
+
+    if (links->nextfree)
+        FREELINKS(links->nextfree)->prevfree = links->prevfree;
+    if (links->prevfree)
+        FREELINKS(links->prevfree)->nextfree = links->nextfree;
+
+    if (e->freelists[fl][sl] == node)
+    {
+        e->freelists[fl][sl] = links->nextfree;
+        if (!e->freelists[fl][sl])
+        {
+            e->slbitmap[fl] &= ~(1U << sl);
+            if (!e->slbitmap[fl])
+                e->flbitmap &= ~(1U << fl);
+        }
+    }
+}
+
+/**
+ * \brief Puts free block at the head of its list.
+ */
+static void _insertFree(t_Engine *e, t_MemNode *node)
+{
+    int fl, sl;
+    t_FreeLinks *links = FREELINKS(node);
+
+    _mapInsert(GET_BLOCKSIZE(node), &fl, &sl);
+
+    links->prevfree = NULL;
+    links->nextfree = e->freelists[fl][sl];
+    if (links->nextfree)
+        FREELINKS(links->nextfree)->prevfree = node;
+    e->freelists[fl][sl] = node;
+
+    e->slbitmap[fl] |= 1U << sl;
+    e->flbitmap |= 1U << fl;
+}
+
+/**
+ * \brief Merges nxt block into src, both blocks must be adjacent.
+ */
+static t_MemNode *_joinBlocks(t_MemNode *src, t_MemNode *nxt)
+{
+    SET_BLOCKSIZE(src, GET_BLOCKSIZE(src) + GET_BLOCKSIZE(nxt));
+    SET_NEXT(src, GET_NEXT(nxt));
+    if (GET_NEXT(src))
+        SET_PREV(GET_NEXT(src), src);
+    return src;
+}
+
+/**
+ * \brief Cuts used block at given offset, rest becomes new used block.
+ *
+ * @return t_MemNode* rest of the block or NULL if rest is too small to be a block
+ */
+static t_MemNode *_splitBlock(t_MemNode *src, size_t offset)
+{
+    t_MemNode *next;
+    size_t size = GET_BLOCKSIZE(src);
+
+    if (size < offset + MINBLOCK)
+        return NULL;
+
+    next = (t_MemNode*)OFFSET(src, offset);
+    SET_BLOCKUSED(next, size - offset);
+    SET_NEXT(next, GET_NEXT(src));
+    SET_PREV(next, src);
+    if (GET_NEXT(next))
+        SET_PREV(GET_NEXT(next), next);
+
+    SET_BLOCKSIZE(src, offset);
+    SET_NEXT(src, next);
+    return next;
+}
+
+/**
+ * \brief Makes whole heap (up to 2^ALLOCATOR_TLSF_FLMAX bytes) a single free block.
+ */
+t_MemNode *_engineInit(t_Heap *heap)
+{
+    t_MemNode *node = (t_MemNode*) heap->start;
+    size_t size = (heap->size > HEAPMAX ? HEAPMAX : heap->size);
+
+    SET_NEXT(node, NULL);
+    SET_PREV(node, NULL);
+    heap->engine.flbitmap = 0;
+    for (int fl = 0; fl < FL_COUNT; fl++)
+    {
+        heap->engine.slbitmap[fl] = 0;
+        for (int sl = 0; sl < SL_COUNT; sl++)
+            heap->engine.freelists[fl][sl] = NULL;
+    }
+    SET_BLOCKFREE(node, size);
+    guard(heap, node);
+    _insertFree(&heap->engine, node);
+    return node;
+}
+
+/**
+ * \brief Takes head of the first list which all blocks fit size,
+ * remainder of block is returned to free lists.
+ *
+ * @param size_t size of block including node
+ * @return t_MemNode* allocated block or NULL
+ */
+t_MemNode *_engineAlloc(t_Heap *heap, size_t size)
+{
+    int fl, sl;
+    t_MemNode *node, *rest;
+
+    if (size < MINBLOCK)
+        size = MINBLOCK;
+
+    _mapSearch(size, &fl, &sl);
+    node = _findSuitable(&heap->engine, &fl, &sl);
+    if (!node)
+        return NULL;
+
+    guard(heap, node);
+    _removeFree(&heap->engine, node);
+    MARK_BLOCKUSED(node);
+
+    rest = _splitBlock(node, size);
+    if (rest)
+    {
+        MARK_BLOCKFREE(rest);
+        _insertFree(&heap->engine, rest);
+    }
+    return node;
+}
+
+/**
+ * \brief Takes block big enough for size and any alignment gap, cuts
+ * aligned block out of it. Gap in front of it is freed, rest after it
+ * is freed like on shrinking.
+ *
+ * @param size_t size of block including node
+ * @param size_t alignment of payload
+ * @return t_MemNode* allocated block or NULL
+ */
+t_MemNode *_engineAllocAligned(t_Heap *heap, size_t size, size_t alignment)
+{
+    t_MemNode *node, *rest;
+    size_t gap;
+
+    if (size < MINBLOCK)
+        size = MINBLOCK;
+
+    node = _engineAlloc(heap, size + alignment + MINBLOCK);
+    if (!node)
+        return NULL;
+
+    gap = _alignGap(node, alignment);
+    if (gap)
+    {
+        rest = _splitBlock(node, gap);
+        _engineFree(heap, node);
+        node = rest;
+    }
+    return _engineResize(heap, node, size);
+}
+
+/**
+ * \brief Marks block as free, merges it with free neighbours and puts it on free list.
+ */
+void _engineFree(t_Heap *heap, t_MemNode *node)
+{
+    t_MemNode *prev = GET_PREV(node), *next = GET_NEXT(node);
+
+    MARK_BLOCKFREE(node);
+
+    if (next && BLOCK_ISFREE(next))
+    {
+        _removeFree(&heap->engine, next);
+        node = _joinBlocks(node, next);
+    }
+
+    if (prev && BLOCK_ISFREE(prev))
+    {
+        _removeFree(&heap->engine, prev);
+        node = _joinBlocks(prev, node);
+    }
+
+    _insertFree(&heap->engine, node);
+}
+
+/**
+ * \brief Allocates up to count blocks of size bytes. Every allocation
+ * takes constant time, so blocks are taken one by one.
+ *
+ * @return size_t number of blocks allocated
+ */
+size_t _engineAllocBatch(t_Heap *heap, size_t size, size_t count, t_MemNode **nodes)
+{
+    size_t done = 0;
+
+    while (done < count && (nodes[done] = _engineAlloc(heap, size)))
+        done++;
+    return done;
+}
+
+/**
+ * \brief Frees count used blocks, every one is merged with its neighbours at once.
+ */
+void _engineFreeBatch(t_Heap *heap, t_MemNode **nodes, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        _engineFree(heap, nodes[i]);
+}
+
+/**
+ * \brief Resizes block in place, cut off rest is merged with following free block.
+ *
+ * Block which is too small takes following free block and, if that's
+ * not enough, preceding free block too, then data is moved to its start.
+ *
+ * @return t_MemNode* node (or previous block it was moved to) or NULL
+ * if there is not enough free space around the block
+ */
+t_MemNode *_engineResize(t_Heap *heap, t_MemNode *node, size_t size)
+{
+    t_MemNode *rest, *prev = GET_PREV(node), *next = GET_NEXT(node);
+    size_t avail = GET_BLOCKSIZE(node), payload = avail - SSIZE;
+
+    if (size < MINBLOCK)
+        size = MINBLOCK;
+
+    if (avail < size)
+    {
+        if (next && BLOCK_ISFREE(next))
+            avail += GET_BLOCKSIZE(next);
+        if (avail < size && !(prev && BLOCK_ISFREE(prev) && avail + GET_BLOCKSIZE(prev) >= size))
+            return NULL;
+
+        if (next && BLOCK_ISFREE(next))
+        {
+            _removeFree(&heap->engine, next);
+            node = _joinBlocks(node, next);
+        }
+
+        if (avail < size)
+        {
+            _removeFree(&heap->engine, prev);
+            prev = _joinBlocks(prev, node);
+            MARK_BLOCKUSED(prev);
+            _amemcopy((void*)OFFSET(prev, SSIZE), (void*)OFFSET(node, SSIZE), payload);
+            node = prev;
+        }
+    }
+
+    rest = _splitBlock(node, size);
+    if (rest)
+        _engineFree(heap, rest);
+    return node;
+}
+
+/**
+ * \brief Placement is given by segregated lists, engine has only HEAP_FIT_BEST.
+ */
+int _engineSetPolicy(t_Heap *heap, t_HeapPolicy policy)
+{
+    (void)heap;
+    return (policy == HEAP_FIT_BEST);
+}
+
+#ifdef ALLOCATOR_STATS
+/**
+ * \brief Smallest size of blocks in the highest non empty list. Request
+ * above it would be searched for in higher lists, so it's the largest
+ * block which can be allocated, up to 1/2^ALLOCATOR_TLSF_SLBITS smaller
+ * than largest free block.
+ */
+size_t _engineLargest(t_Heap *heap)
+{
+    t_Engine *e = &heap->engine;
+    int fl, sl, f;
+
+    if (!e->flbitmap)
+        return 0;
+
+    fl = _fls(e->flbitmap);
+    sl = _fls(e->slbitmap[fl]);
+    if (fl == 0)
+        return (size_t)sl * (SMALL_BLOCK / SL_COUNT);
+
+    f = fl + FL_SHIFT - 1;
+    return ((size_t)1 << f) + ((size_t)sl << (f - ALLOCATOR_TLSF_SLBITS));
+}
+#endif
@@ -0,0 +1,147 @@
+/*
+ * trace.c
+ * Allocation trace, used when ALLOCATOR_TRACE is defined.
+ * Every thread claims next slot of ring buffer with single atomic add,
+ * fills it and marks it complete by storing its sequence number.
+ * Whoever fills last slot of either half of the ring, flushes all
+ * complete records to _atracewrite(). Only one thread flushes at time,
+ * others never wait for it unless ring is full, so no record is lost.
+ * Trace file is plain array of t_TraceRecord, replayed by bench/replay.
+ *
+ * Author: Jarek Zok <jarekzok@gmail.com>
+ * Licence: MIT https://opensource.org/licenses/MIT
+ *
+ * Github: https://github.com/lucidm
+ *
+ */
+
+#include <allocator.h>
+#include <allocator_lib.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#if ALLOCATOR_TRACE_RECORDS < 2 || (ALLOCATOR_TRACE_RECORDS & (ALLOCATOR_TRACE_RECORDS - 1))
+#error ALLOCATOR_TRACE_RECORDS has to be power of two
+#endif
+
+#define RING_MASK (ALLOCATOR_TRACE_RECORDS - 1)
+#define HALF_MASK (ALLOCATOR_TRACE_RECORDS / 2 - 1)
+
+static t_TraceRecord ring[ALLOCATOR_TRACE_RECORDS];
+static uint64_t head;
+static uint64_t flushed;
+static uint8_t flushing;
+static uint8_t registered;
+static int tracefd = -1;
+
+/**
+ * \brief Default trace output, appends to ALLOCATOR_TRACE_FILE.
+ * Plain write() is used, stdio could allocate.
+ */
+void __attribute__((weak)) _atracewrite(const void *buf, size_t len)
+{
+    ssize_t done;
+
+    if (tracefd < 0)
+        tracefd = open(ALLOCATOR_TRACE_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (tracefd < 0)
+        return;
+
+    while (len)
+    {
+        done = write(tracefd, buf, len);
+        if (done <= 0)
+            return;
+        buf = (const uint8_t*)buf + done;
+        len -= done;
+    }
+}
+
+/**
+ * \brief Default timestamp, nanoseconds of monotonic clock.
+ */
+uint64_t __attribute__((weak)) _atraceclock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * \brief Writes complete records following already flushed ones.
+ * Does nothing if other thread is flushing.
+ */
+static void _flush(void)
+{
+    uint64_t from, to, end;
+
+    if (__atomic_exchange_n(&flushing, 1, __ATOMIC_ACQUIRE))
+        return;
+
+    from = to = __atomic_load_n(&flushed, __ATOMIC_RELAXED);
+    end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    while (to < end &&
+           __atomic_load_n(&ring[to & RING_MASK].seq, __ATOMIC_ACQUIRE) == (uint32_t)(to + 1))
+        to++;
+
+    while (from < to)
+    {
+        //stop at the end of the ring, rest is written in next pass
+        end = ((from & RING_MASK) + (to - from) > ALLOCATOR_TRACE_RECORDS ?
+               ALLOCATOR_TRACE_RECORDS - (from & RING_MASK) : to - from);
+        _atracewrite(&ring[from & RING_MASK], end * sizeof(t_TraceRecord));
+        from += end;
+    }
+
+    __atomic_store_n(&flushed, to, __ATOMIC_RELEASE);
+    __atomic_store_n(&flushing, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * \brief Flushes all records, waits for records being filled by other threads.
+ */
+void _atracesync(void)
+{
+    while (__atomic_load_n(&flushed, __ATOMIC_ACQUIRE) < __atomic_load_n(&head, __ATOMIC_ACQUIRE))
+    {
+        _flush();
+        sched_yield();
+    }
+}
+
+/**
+ * \brief Puts record in ring buffer, waits for flush only if buffer is full.
+ *
+ * @param t_TraceOp op operation
+ * @param void* ptr address returned or freed
+ * @param uintptr_t arg previous address for realloc, alignment for memalign
+ * @param size_t size requested size
+ */
+void _traceRecord(t_TraceOp op, void *ptr, uintptr_t arg, size_t size)
+{
+    uint64_t idx = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    t_TraceRecord *rec = &ring[idx & RING_MASK];
+
+    if (!registered && !__atomic_exchange_n(&registered, 1, __ATOMIC_RELAXED))
+        atexit(_atracesync);
+
+    while (idx - __atomic_load_n(&flushed, __ATOMIC_ACQUIRE) >= ALLOCATOR_TRACE_RECORDS)
+    {
+        _flush();
+        sched_yield();
+    }
+
+    rec->op = op;
+    rec->time = _atraceclock();
+    rec->size = size;
+    rec->ptr = (uintptr_t)ptr;
+    rec->arg = arg;
+    __atomic_store_n(&rec->seq, (uint32_t)(idx + 1), __ATOMIC_RELEASE);
+
+    if ((idx & HALF_MASK) == HALF_MASK)
+        _flush();
+}